@@ -0,0 +1,173 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STACK3D_OSGGIS_HORAOTILE
+#define STACK3D_OSGGIS_HORAOTILE
+
+#include <osg/Vec3>
+#include <osg/BoundingBox>
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+#include <stdint.h>
+
+namespace osgGIS {
+
+//! header of a Horao tile (.htile), it's followed by the vertex, normal and index
+//! sections, aligned so that they can be used in place from a memory mapped file
+//! @note values are in the byte order of the writer, the reader checks it's its own
+struct HoraoTileHeader {
+    enum {
+        VERSION = 2,
+        BYTE_ORDER_MARK = 0x01020304,
+        ALIGNMENT = 16 //!< of sections, from the start of the file
+    };
+
+    char magic[8];         //!< "HORAOTIL"
+    uint32_t byteOrder;    //!< BYTE_ORDER_MARK in the writer byte order
+    uint32_t version;
+    uint32_t numVertices;  //!< osg::Vec3 positions, and as many osg::Vec3 normals
+    uint32_t numIndices;   //!< uint32_t indices of triangles
+    uint32_t maxIndex;     //!< greatest index, 0 if there is none
+    uint32_t reserved;     //!< 0, keeps the following fields aligned
+    float bound[6];        //!< xmin, ymin, zmin, xmax, ymax, zmax
+    uint64_t vertexOffset; //!< sections offsets, from the start of the file
+    uint64_t normalOffset;
+    uint64_t indexOffset;
+    uint64_t fileSize;
+
+    //! header of a tile, sections follow it in this order
+    HoraoTileHeader( uint32_t nVertices = 0, uint32_t nIndices = 0, uint32_t maxIdx = 0, const osg::BoundingBox& bbox = osg::BoundingBox() )
+        : byteOrder( BYTE_ORDER_MARK )
+        , version( VERSION )
+        , numVertices( nVertices )
+        , numIndices( nIndices )
+        , maxIndex( maxIdx )
+        , reserved( 0 ) {
+        std::memcpy( magic, "HORAOTIL", 8 );
+        bound[0] = bbox.xMin();
+        bound[1] = bbox.yMin();
+        bound[2] = bbox.zMin();
+        bound[3] = bbox.xMax();
+        bound[4] = bbox.yMax();
+        bound[5] = bbox.zMax();
+        vertexOffset = aligned( sizeof( HoraoTileHeader ) );
+        normalOffset = aligned( vertexOffset + uint64_t( numVertices ) * sizeof( osg::Vec3 ) );
+        indexOffset = aligned( normalOffset + uint64_t( numVertices ) * sizeof( osg::Vec3 ) );
+        fileSize = indexOffset + uint64_t( numIndices ) * sizeof( uint32_t );
+    }
+
+    const osg::BoundingBox boundingBox() const {
+        return osg::BoundingBox( bound[0], bound[1], bound[2], bound[3], bound[4], bound[5] );
+    }
+
+    //! @return false, error is then set, if the header cannot be used to read a file of this size
+    bool check( uint64_t size, std::string& error ) const {
+        // the sections must be where we would have put them
+        const HoraoTileHeader expected( numVertices, numIndices );
+
+        if ( std::memcmp( magic, "HORAOTIL", 8 ) ) {
+            error = "not a horao tile";
+        }
+        else if ( byteOrder != BYTE_ORDER_MARK ) {
+            error = "tile written with another byte order";
+        }
+        else if ( version != VERSION ) {
+            error = "unsupported tile version";
+        }
+        else if ( numIndices % 3 ) {
+            error = "indices are not triangles";
+        }
+        else if ( numIndices && maxIndex >= numVertices ) {
+            error = "index out of range";
+        }
+        else if ( vertexOffset != expected.vertexOffset || normalOffset != expected.normalOffset
+                  || indexOffset != expected.indexOffset || fileSize != expected.fileSize ) {
+            error = "inconsistent section offsets";
+        }
+        else if ( fileSize != size ) {
+            error = "truncated tile";
+        }
+
+        return error.empty();
+    }
+
+    //! maxIndex is the writer's word, a corrupted or edited file can still have
+    //! indices out of range, they are checked here
+    //! @param file the whole tile, of a size accepted by check()
+    //! @return false, error is then set, if an index is not less than numVertices
+    //! @note it's the only work of the reader that grows with the number of elements,
+    //!       one pass on the index section (4 bytes per index)
+    bool checkIndices( const char* file, std::string& error ) const {
+        const uint32_t* indices = reinterpret_cast< const uint32_t* >( file + indexOffset );
+
+        for ( uint32_t i = 0; i < numIndices; i++ ) {
+            if ( indices[i] >= numVertices ) {
+                error = "index out of range";
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static uint64_t aligned( uint64_t offset ) {
+        return ( offset + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+    }
+};
+
+//! writes a tile, indices must be less than numVertices
+//! @return false if an index is out of range (nothing is written) or if the stream failed
+inline
+bool writeHoraoTile( std::ostream& out, const osg::Vec3* vertices, const osg::Vec3* normals, uint32_t numVertices,
+                     const uint32_t* indices, uint32_t numIndices )
+{
+    uint32_t maxIndex = 0;
+
+    for ( uint32_t i = 0; i < numIndices; i++ ) {
+        maxIndex = std::max( maxIndex, indices[i] );
+    }
+
+    if ( numIndices && maxIndex >= numVertices ) {
+        return false;
+    }
+
+    osg::BoundingBox bbox;
+
+    for ( uint32_t v = 0; v < numVertices; v++ ) {
+        bbox.expandBy( vertices[v] );
+    }
+
+    const HoraoTileHeader header( numVertices, numIndices, maxIndex, bbox );
+    const char padding[HoraoTileHeader::ALIGNMENT] = {};
+
+    out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+    out.write( padding, header.vertexOffset - sizeof( header ) );
+    out.write( reinterpret_cast< const char* >( vertices ), numVertices * sizeof( osg::Vec3 ) );
+    out.write( padding, header.normalOffset - header.vertexOffset - numVertices * sizeof( osg::Vec3 ) );
+    out.write( reinterpret_cast< const char* >( normals ), numVertices * sizeof( osg::Vec3 ) );
+    out.write( padding, header.indexOffset - header.normalOffset - numVertices * sizeof( osg::Vec3 ) );
+    out.write( reinterpret_cast< const char* >( indices ), numIndices * sizeof( uint32_t ) );
+    return out.good();
+}
+
+}
+
+#endif
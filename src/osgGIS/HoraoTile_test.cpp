@@ -0,0 +1,97 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "HoraoTile.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+int main( int, char** )
+{
+    const osg::Vec3 vertices[4] = { osg::Vec3( 0, 0, 0 ), osg::Vec3( 1, 0, 0 ), osg::Vec3( 0, 1, 0 ), osg::Vec3( 1, 1, 2 ) };
+    const osg::Vec3 normals[4] = { osg::Vec3( 0, 0, 1 ), osg::Vec3( 0, 0, 1 ), osg::Vec3( 0, 0, 1 ), osg::Vec3( 0, 0, 1 ) };
+    const uint32_t indices[6] = { 0, 1, 2, 1, 3, 2 };
+
+    // a written tile is read back
+    {
+        std::ostringstream out;
+
+        if ( !osgGIS::writeHoraoTile( out, vertices, normals, 4, indices, 6 ) ) {
+            std::cerr << "failed to write tile\n";
+            return EXIT_FAILURE;
+        }
+
+        const std::string tile = out.str();
+        const osgGIS::HoraoTileHeader& header = *reinterpret_cast< const osgGIS::HoraoTileHeader* >( tile.data() );
+        std::string error;
+
+        if ( tile.size() < sizeof( header ) || !header.check( tile.size(), error ) || !header.checkIndices( tile.data(), error ) ) {
+            std::cerr << "failed to check tile: " << error << "\n";
+            return EXIT_FAILURE;
+        }
+
+        if ( header.numVertices != 4 || header.numIndices != 6 || header.maxIndex != 3
+                || header.boundingBox().zMax() != 2 || header.vertexOffset % osgGIS::HoraoTileHeader::ALIGNMENT
+                || reinterpret_cast< const osg::Vec3* >( tile.data() + header.vertexOffset )[3] != vertices[3]
+                || reinterpret_cast< const osg::Vec3* >( tile.data() + header.normalOffset )[3] != normals[3]
+                || reinterpret_cast< const uint32_t* >( tile.data() + header.indexOffset )[4] != 3 ) {
+            std::cerr << "wrong tile content\n";
+            return EXIT_FAILURE;
+        }
+
+        // truncated
+        if ( header.check( tile.size() - 4, error ) ) {
+            std::cerr << "accepted a truncated tile\n";
+            return EXIT_FAILURE;
+        }
+
+        // an index changed in the file, the header is unchanged
+        std::string corrupted( tile );
+        reinterpret_cast< uint32_t* >( &corrupted[0] + header.indexOffset )[4] = 4;
+        error.clear();
+
+        if ( !header.check( corrupted.size(), error ) || header.checkIndices( corrupted.data(), error ) ) {
+            std::cerr << "accepted an index out of range in the file\n";
+            return EXIT_FAILURE;
+        }
+
+        // maxIndex changed in the header
+        osgGIS::HoraoTileHeader wrongMax( header );
+        wrongMax.maxIndex = 4;
+        error.clear();
+
+        if ( wrongMax.check( tile.size(), error ) ) {
+            std::cerr << "accepted a maximum index out of range\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // out of range indices are not written
+    {
+        const uint32_t wrong[3] = { 0, 1, 4 };
+        std::ostringstream out;
+
+        if ( osgGIS::writeHoraoTile( out, vertices, normals, 4, wrong, 3 ) || !out.str().empty() ) {
+            std::cerr << "wrote an index out of range\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "PostgisConnection.h"
+
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
+
+namespace osgGIS {
+
+//! statement names are derived from the query text, so that the same query,
+//! used for all the tiles of a layer, is prepared only once per connection
+inline
+const std::string statementName( const std::string& query )
+{
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for ( std::string::const_iterator c = query.begin(); c != query.end(); ++c ) {
+        hash = ( hash ^ static_cast< unsigned char >( *c ) ) * 1099511628211ULL;
+    }
+
+    std::stringstream name;
+    name << "horao_" << std::hex << hash;
+    return name.str();
+}
+
+//! pointers to parameter values, as expected by libpq
+inline
+const std::vector< const char* > parameterValues( const PostgisConnection::Parameters& params )
+{
+    std::vector< const char* > values;
+
+    for ( PostgisConnection::Parameters::const_iterator p = params.begin(); p != params.end(); ++p ) {
+        values.push_back( p->c_str() );
+    }
+
+    return values;
+}
+
+PGresult* PostgisConnection::prepare( const std::string& query, std::string& name )
+{
+    name = statementName( query );
+
+    if ( _prepared.count( name ) ) {
+        return NULL;
+    }
+
+    // parameter types are infered by the server
+    PGresult* res = PQprepare( _conn, name.c_str(), query.c_str(), 0, NULL );
+
+    if ( PGRES_COMMAND_OK != PQresultStatus( res ) ) {
+        return res;
+    }
+
+    PQclear( res );
+    _prepared.insert( name );
+    return NULL;
+}
+
+PGresult* PostgisConnection::exec( const std::string& query, const Parameters& params )
+{
+    if ( params.empty() ) {
+        return PQexecParams( _conn, query.c_str(), 0, NULL, NULL, NULL, NULL, BINARY_FORMAT );
+    }
+
+    std::string name;
+
+    if ( PGresult* failed = prepare( query, name ) ) {
+        return failed;
+    }
+
+    const std::vector< const char* > values( parameterValues( params ) );
+    return PQexecPrepared( _conn, name.c_str(), int( values.size() ), &values[0], NULL, NULL, BINARY_FORMAT );
+}
+
+bool PostgisConnection::send( const std::string& query, const Parameters& params )
+{
+    if ( params.empty() ) {
+        return PQsendQueryParams( _conn, query.c_str(), 0, NULL, NULL, NULL, NULL, BINARY_FORMAT );
+    }
+
+    std::string name;
+
+    if ( PGresult* failed = prepare( query, name ) ) {
+        // the error message is kept by the connection
+        PQclear( failed );
+        return false;
+    }
+
+    const std::vector< const char* > values( parameterValues( params ) );
+    return PQsendQueryPrepared( _conn, name.c_str(), int( values.size() ), &values[0], NULL, NULL, BINARY_FORMAT );
+}
+
+ConnectionPool& ConnectionPool::instance()
+{
+    static ConnectionPool pool;
+    return pool;
+}
+
+ConnectionPool::ConnectionPool()
+    : _maxIdle( 8 )
+    , _idleTimeout( 60 )
+    , _hits( 0 )
+    , _misses( 0 )
+{}
+
+ConnectionPool::~ConnectionPool()
+{
+    for ( IdleMap::iterator i = _idle.begin(); i != _idle.end(); ++i ) {
+        for ( std::list< IdleConnection >::iterator c = i->second.begin(); c != i->second.end(); ++c ) {
+            delete c->connection;
+        }
+    }
+}
+
+void ConnectionPool::configure( size_t maxIdle, double idleTimeout )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _maxIdle = maxIdle;
+    _idleTimeout = idleTimeout;
+    expire();
+}
+
+PostgisConnection* ConnectionPool::acquire( const std::string& connInfo )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        expire();
+
+        std::list< IdleConnection >& idle = _idle[ connInfo ];
+
+        // most recently used first, it's the least likely to be broken
+        while ( !idle.empty() ) {
+            PostgisConnection* connection = idle.back().connection;
+            idle.pop_back();
+
+            if ( connection->isIdle() ) {
+                ++_hits;
+                return connection;
+            }
+
+            delete connection;
+        }
+
+        ++_misses;
+    }
+
+    // connect without holding the lock, this is the slow part
+    return new PostgisConnection( connInfo );
+}
+
+void ConnectionPool::release( const std::string& connInfo, PostgisConnection* connection )
+{
+    if ( !connection->isIdle() ) {
+        delete connection;
+        return;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    std::list< IdleConnection >& idle = _idle[ connInfo ];
+
+    if ( idle.size() >= _maxIdle ) {
+        delete connection;
+        return;
+    }
+
+    IdleConnection c = { connection, osg::Timer::instance()->tick() };
+    idle.push_back( c );
+}
+
+void ConnectionPool::expire()
+{
+    const osg::Timer_t now = osg::Timer::instance()->tick();
+
+    for ( IdleMap::iterator i = _idle.begin(); i != _idle.end(); ++i ) {
+        std::list< IdleConnection >& idle = i->second;
+
+        // oldest are at the front
+        while ( !idle.empty()
+                && ( idle.size() > _maxIdle
+                     || osg::Timer::instance()->delta_s( idle.front().since, now ) > _idleTimeout ) ) {
+            delete idle.front().connection;
+            idle.pop_front();
+        }
+    }
+}
+
+}
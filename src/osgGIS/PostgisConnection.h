@@ -0,0 +1,264 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STACK3D_OSGGIS_POSTGISCONNECTION
+#define STACK3D_OSGGIS_POSTGISCONNECTION
+
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+
+#include <libpq-fe.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <list>
+
+namespace osgGIS {
+
+//! for postgres connection RAII
+struct PostgisConnection {
+
+    PostgisConnection( const std::string& connInfo )
+        : _conn( PQconnectdb( connInfo.c_str() ) )
+    {}
+
+    operator bool() {
+        return CONNECTION_OK == PQstatus( _conn );
+    }
+
+    //! @return true if the connection is ok and no transaction or query is pending
+    bool isIdle() {
+        return CONNECTION_OK == PQstatus( _conn )
+               && PQTRANS_IDLE == PQtransactionStatus( _conn );
+    }
+
+    ~PostgisConnection() {
+        if ( _conn ) {
+            PQfinish( _conn );
+        }
+    }
+
+    //! text values of query parameters $1, $2...
+    typedef std::vector< std::string > Parameters;
+
+    // for RAII ok query results
+    // results are requested in binary format, geometries are then sent as WKB
+    // instead of hex encoded WKB (half the transfer and no hex decoding)
+    // queries with parameters are prepared (once per connection) and executed
+    struct QueryResult {
+        QueryResult( PostgisConnection& conn, const std::string& query, const Parameters& params = Parameters() )
+            : _res( conn.exec( query, params ) )
+            , _error( PQresultErrorMessage( _res ) )
+        {}
+
+        ~QueryResult() {
+            PQclear( _res );
+        }
+
+        operator bool() const {
+            return _error.empty();
+        }
+
+        PGresult* get() {
+            return _res;
+        }
+
+        const std::string& error() const {
+            return _error;
+        }
+
+    private:
+        PGresult* _res;
+        const std::string _error;
+        // non copyable
+        QueryResult( const QueryResult& );
+        QueryResult operator=( const QueryResult& );
+    };
+
+    // for RAII of query results fetched one row at a time (single row mode)
+    // rows can be processed while the next ones are being transfered,
+    // and the whole result is never held in memory
+    struct RowStream {
+        RowStream( PostgisConnection& conn, const std::string& query, const Parameters& params = Parameters() )
+            : _conn( conn._conn )
+            , _res( NULL ) {
+            if ( !conn.send( query, params )
+                    || !PQsetSingleRowMode( _conn ) ) {
+                _error = PQerrorMessage( _conn );
+            }
+        }
+
+        ~RowStream() {
+            PQclear( _res );
+
+            // consume remaining results, if any, to leave the connection usable
+            while ( PGresult* res = PQgetResult( _conn ) ) {
+                PQclear( res );
+            }
+        }
+
+        //! fetch next row
+        //! @return false if there is no more rows or in case of error
+        bool next() {
+            PQclear( _res );
+            _res = PQgetResult( _conn );
+
+            if ( !_res ) {
+                return false;
+            }
+
+            switch ( PQresultStatus( _res ) ) {
+            case PGRES_SINGLE_TUPLE:
+                return true;
+            case PGRES_TUPLES_OK: // end of rows
+                return false;
+            default:
+                _error = PQresultErrorMessage( _res );
+                return false;
+            }
+        }
+
+        operator bool() const {
+            return _error.empty();
+        }
+
+        //! result containing the current row, only one tuple
+        PGresult* get() {
+            return _res;
+        }
+
+        const std::string& error() const {
+            return _error;
+        }
+
+    private:
+        PGconn* _conn;
+        PGresult* _res;
+        std::string _error;
+        // non copyable
+        RowStream( const RowStream& );
+        RowStream operator=( const RowStream& );
+    };
+
+private:
+    PGconn* _conn;
+    std::set< std::string > _prepared; // names of statements prepared on this connection
+    static const int BINARY_FORMAT = 1;
+
+    //! prepare the query on first use
+    //! @param name set to the name of the prepared statement
+    //! @return NULL on success, the failed result otherwise
+    PGresult* prepare( const std::string& query, std::string& name );
+
+    //! execute the query, as a prepared statement if there are parameters
+    PGresult* exec( const std::string& query, const Parameters& params );
+
+    //! send the query for asynchronous execution, as a prepared statement if there are parameters
+    //! @return false on failure (see PQerrorMessage)
+    bool send( const std::string& query, const Parameters& params );
+    // non copyable
+    PostgisConnection( const PostgisConnection& );
+    PostgisConnection operator=( const PostgisConnection& );
+};
+
+//! process-wide pool of connections, keyed by conn_info
+//! connections are shared by all the loading threads (DatabasePager), but a
+//! connection is used by only one thread at a time
+struct ConnectionPool {
+    static ConnectionPool& instance();
+
+    //! @return an idle connection from the pool (hit) or a new one (miss)
+    //! @note the caller gets ownership until release()
+    PostgisConnection* acquire( const std::string& connInfo );
+
+    //! give the connection back to the pool, the connection is closed if the
+    //! pool is full or if it is not idle
+    void release( const std::string& connInfo, PostgisConnection* );
+
+    //! @param maxIdle maximum number of idle connections kept for each conn_info
+    //! @param idleTimeout idle connections are closed after this delay (in seconds)
+    void configure( size_t maxIdle, double idleTimeout );
+
+    size_t hits() const {
+        return _hits;
+    }
+
+    size_t misses() const {
+        return _misses;
+    }
+
+    ~ConnectionPool();
+
+private:
+    ConnectionPool();
+
+    struct IdleConnection {
+        PostgisConnection* connection;
+        osg::Timer_t since;
+    };
+
+    typedef std::map< std::string, std::list< IdleConnection > > IdleMap;
+
+    OpenThreads::Mutex _mutex;
+    IdleMap _idle;
+    size_t _maxIdle;
+    double _idleTimeout;
+    //! atomic, they are read without _mutex
+    OpenThreads::Atomic _hits;
+    OpenThreads::Atomic _misses;
+
+    //! close connections idle for too long, _mutex must be locked
+    void expire();
+
+    // non copyable
+    ConnectionPool( const ConnectionPool& );
+    ConnectionPool operator=( const ConnectionPool& );
+};
+
+//! for RAII of connections from the pool
+struct PooledConnection {
+    PooledConnection( const std::string& connInfo )
+        : _connInfo( connInfo )
+        , _connection( ConnectionPool::instance().acquire( connInfo ) )
+    {}
+
+    ~PooledConnection() {
+        ConnectionPool::instance().release( _connInfo, _connection );
+    }
+
+    operator bool() {
+        return *_connection;
+    }
+
+    PostgisConnection& operator*() {
+        return *_connection;
+    }
+
+private:
+    const std::string _connInfo;
+    PostgisConnection* _connection;
+    // non copyable
+    PooledConnection( const PooledConnection& );
+    PooledConnection operator=( const PooledConnection& );
+};
+
+}
+#endif
@@ -0,0 +1,353 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "HoraoTile.h"
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/State>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#define DEBUG_OUT if (0) std::cerr
+
+//! memory mapping of a file, shared by the arrays using it
+//! @note the mapping is private: arrays can be modified (copy on write) without changing the file
+struct MappedFile : osg::Referenced {
+    MappedFile( const std::string& path )
+        : _data( NULL )
+        , _size( 0 ) {
+        const int fd = open( path.c_str(), O_RDONLY );
+
+        if ( fd < 0 ) {
+            return;
+        }
+
+        struct stat st;
+
+        if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+            void* data = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+            if ( data != MAP_FAILED ) {
+                _data = static_cast< char* >( data );
+                _size = st.st_size;
+            }
+        }
+
+        // the mapping stays valid after the file is closed
+        close( fd );
+    }
+
+    operator bool() const {
+        return _data;
+    }
+
+    char* data() const {
+        return _data;
+    }
+
+    uint64_t size() const {
+        return _size;
+    }
+
+private:
+    char* _data;
+    uint64_t _size;
+
+    ~MappedFile() {
+        if ( _data ) {
+            munmap( _data, _size );
+        }
+    }
+};
+
+//! array of elements of type T in a mapped file, there is no copy
+//! @note this is a view, it cannot be resized, and it's not a osg::TemplateArray so
+//!       osg serializers, that cast arrays according to their type, must not be used on it
+template< typename T, osg::Array::Type ARRAY_TYPE, int DATA_SIZE, int DATA_TYPE >
+struct MappedArray : osg::Array {
+    MappedArray( MappedFile* file, uint64_t offset, unsigned numElements )
+        : osg::Array( ARRAY_TYPE, DATA_SIZE, DATA_TYPE )
+        , _file( file )
+        , _data( reinterpret_cast< T* >( file->data() + offset ) )
+        , _numElements( numElements )
+    {}
+
+    MappedArray( const MappedArray& other, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY )
+        : osg::Array( other, copyop )
+        , _file( other._file )
+        , _data( other._data )
+        , _numElements( other._numElements )
+    {}
+
+    virtual osg::Object* cloneType() const {
+        return new MappedArray( _file.get(), 0, 0 );
+    }
+
+    virtual osg::Object* clone( const osg::CopyOp& copyop ) const {
+        return new MappedArray( *this, copyop );
+    }
+
+    virtual bool isSameKindAs( const osg::Object* obj ) const {
+        return dynamic_cast< const MappedArray* >( obj ) != NULL;
+    }
+
+    virtual const char* libraryName() const {
+        return "osgGIS";
+    }
+
+    virtual const char* className() const {
+        return "MappedArray";
+    }
+
+    // arrays visitors only know osg arrays types
+    virtual void accept( osg::ArrayVisitor& ) {}
+
+    virtual void accept( osg::ConstArrayVisitor& ) const {}
+
+    virtual void accept( unsigned int index, osg::ValueVisitor& vv ) {
+        vv.apply( _data[index] );
+    }
+
+    virtual void accept( unsigned int index, osg::ConstValueVisitor& vv ) const {
+        vv.apply( _data[index] );
+    }
+
+    virtual int compare( unsigned int lhs, unsigned int rhs ) const {
+        if ( _data[lhs] < _data[rhs] ) {
+            return -1;
+        }
+
+        if ( _data[rhs] < _data[lhs] ) {
+            return 1;
+        }
+
+        return 0;
+    }
+
+    virtual const GLvoid* getDataPointer() const {
+        return _data;
+    }
+
+    virtual unsigned int getTotalDataSize() const {
+        return _numElements * sizeof( T );
+    }
+
+    virtual unsigned int getNumElements() const {
+        return _numElements;
+    }
+
+    virtual void reserveArray( unsigned int ) {}
+
+    virtual void resizeArray( unsigned int ) {}
+
+private:
+    osg::ref_ptr< MappedFile > _file;
+    T* _data;
+    unsigned _numElements;
+};
+
+typedef MappedArray< osg::Vec3, osg::Array::Vec3ArrayType, 3, GL_FLOAT > MappedVec3Array;
+
+//! triangles indices in a mapped file, drawn like osg::DrawElementsUInt
+struct MappedDrawElements : osg::DrawElements {
+    MappedDrawElements( MappedFile* file, uint64_t offset, unsigned numIndices )
+        : osg::DrawElements( osg::PrimitiveSet::PrimitiveType, GL_TRIANGLES )
+        , _file( file )
+        , _data( reinterpret_cast< GLuint* >( file->data() + offset ) )
+        , _numIndices( numIndices )
+    {}
+
+    MappedDrawElements( const MappedDrawElements& other, const osg::CopyOp& copyop = osg::CopyOp::SHALLOW_COPY )
+        : osg::DrawElements( other, copyop )
+        , _file( other._file )
+        , _data( other._data )
+        , _numIndices( other._numIndices )
+    {}
+
+    virtual osg::Object* cloneType() const {
+        return new MappedDrawElements( _file.get(), 0, 0 );
+    }
+
+    virtual osg::Object* clone( const osg::CopyOp& copyop ) const {
+        return new MappedDrawElements( *this, copyop );
+    }
+
+    virtual bool isSameKindAs( const osg::Object* obj ) const {
+        return dynamic_cast< const MappedDrawElements* >( obj ) != NULL;
+    }
+
+    virtual const char* libraryName() const {
+        return "osgGIS";
+    }
+
+    virtual const char* className() const {
+        return "MappedDrawElements";
+    }
+
+    virtual const GLvoid* getDataPointer() const {
+        return _data;
+    }
+
+    virtual unsigned int getTotalDataSize() const {
+        return _numIndices * sizeof( GLuint );
+    }
+
+    virtual bool supportsBufferObject() const {
+        return true;
+    }
+
+    //! same as osg::DrawElementsUInt
+    virtual void draw( osg::State& state, bool useVertexBufferObjects ) const {
+        if ( useVertexBufferObjects ) {
+            osg::GLBufferObject* ebo = getOrCreateGLBufferObject( state.getContextID() );
+            state.bindElementBufferObject( ebo );
+
+            if ( ebo ) {
+                glDrawElements( _mode, _numIndices, GL_UNSIGNED_INT, reinterpret_cast< const GLvoid* >( ebo->getOffset( getBufferIndex() ) ) );
+                return;
+            }
+        }
+
+        glDrawElements( _mode, _numIndices, GL_UNSIGNED_INT, _data );
+    }
+
+    virtual void accept( osg::PrimitiveFunctor& functor ) const {
+        if ( _numIndices ) {
+            functor.drawElements( _mode, _numIndices, _data );
+        }
+    }
+
+    virtual void accept( osg::PrimitiveIndexFunctor& functor ) const {
+        if ( _numIndices ) {
+            functor.drawElements( _mode, _numIndices, _data );
+        }
+    }
+
+    virtual unsigned int index( unsigned int pos ) const {
+        return _data[pos];
+    }
+
+    virtual unsigned int getNumIndices() const {
+        return _numIndices;
+    }
+
+    virtual void offsetIndices( int offset ) {
+        for ( unsigned i = 0; i < _numIndices; i++ ) {
+            _data[i] += offset;
+        }
+    }
+
+    // the number of indices is fixed by the file
+    virtual void reserveElements( unsigned int ) {}
+
+    virtual void setElement( unsigned int i, unsigned int value ) {
+        _data[i] = value;
+    }
+
+    virtual unsigned int getElement( unsigned int i ) {
+        return _data[i];
+    }
+
+    virtual void addElement( unsigned int ) {}
+
+private:
+    osg::ref_ptr< MappedFile > _file;
+    GLuint* _data;
+    unsigned _numIndices;
+};
+
+//! the bound is the one of the header, vertices are not read
+struct HeaderBound : osg::Drawable::ComputeBoundingBoxCallback {
+    HeaderBound( const osg::BoundingBox& bound ): _bound( bound ) {}
+
+    virtual osg::BoundingBox computeBound( const osg::Drawable& ) const {
+        return _bound;
+    }
+
+private:
+    const osg::BoundingBox _bound;
+};
+
+//! reads Horao tiles (.htile), written by horaoTileWriter, by mapping them in memory,
+//! the geometry arrays are views of the file, loading is then limited by I/O
+//! @note indices are read once to check they are in range, tiles are not trusted
+struct ReaderWriterHTILE : osgDB::ReaderWriter {
+    ReaderWriterHTILE() {
+        supportsExtension( "htile", "Horao tile" );
+    }
+
+    const char* className() const {
+        return "ReaderWriterHTILE";
+    }
+
+    ReadResult readNode( std::istream&, const Options* ) const {
+        return ReadResult::NOT_IMPLEMENTED;
+    }
+
+    ReadResult readNode( const std::string& fileName, const Options* options ) const {
+        if ( !acceptsExtension( osgDB::getLowerCaseFileExtension( fileName ) ) ) {
+            return ReadResult::FILE_NOT_HANDLED;
+        }
+
+        const std::string path = osgDB::findDataFile( fileName, options );
+
+        if ( path.empty() ) {
+            return ReadResult::FILE_NOT_FOUND;
+        }
+
+        osg::ref_ptr< MappedFile > file = new MappedFile( path );
+
+        if ( !*file || file->size() < sizeof( osgGIS::HoraoTileHeader ) ) {
+            std::cerr << "failed to map " << path << "\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        const osgGIS::HoraoTileHeader& header = *reinterpret_cast< const osgGIS::HoraoTileHeader* >( file->data() );
+        std::string error;
+
+        if ( !header.check( file->size(), error ) || !header.checkIndices( file->data(), error ) ) {
+            std::cerr << "failed to read " << path << ": " << error << "\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        DEBUG_OUT << "mapped " << header.numVertices << " vertices and " << header.numIndices / 3 << " triangles from " << path << "\n";
+
+        osg::ref_ptr< osg::Geometry > geometry = new osg::Geometry;
+        geometry->setUseVertexBufferObjects( true );
+        geometry->setVertexArray( new MappedVec3Array( file.get(), header.vertexOffset, header.numVertices ) );
+        geometry->setNormalArray( new MappedVec3Array( file.get(), header.normalOffset, header.numVertices ) );
+        geometry->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+        geometry->addPrimitiveSet( new MappedDrawElements( file.get(), header.indexOffset, header.numIndices ) );
+        geometry->setComputeBoundingBoxCallback( new HeaderBound( header.boundingBox() ) );
+
+        osg::ref_ptr< osg::Geode > geode = new osg::Geode;
+        geode->addDrawable( geometry.get() );
+        return geode.release();
+    }
+};
+
+REGISTER_OSGPLUGIN( htile, ReaderWriterHTILE )
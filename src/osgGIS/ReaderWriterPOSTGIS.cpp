@@ -18,6 +18,8 @@
  */
 #include "SFosg.h"
 #include "StringUtils.h"
+#include "PostgisConnection.h"
+#include "TileCache.h"
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReaderWriter>
@@ -26,9 +28,17 @@
 #include <osg/ShapeDrawable>
 #include <osg/MatrixTransform>
 #include <osgUtil/Optimizer>
+#include <OpenThreads/Thread>
 
 #include <sstream>
+#include <iomanip>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cctype>
+#include <stdint.h>
+#include <limits>
+#include <algorithm>
 
 #include <gdal/gdal_priv.h>
 #include <gdal/cpl_conv.h>
@@ -61,61 +71,568 @@ private:
     GDALDataset* _raster;
 };
 
-//! for postgres connection RAII
-struct PostgisConnection {
+inline
+bool isTextType( Oid type )
+{
+    return type == TEXTOID || type == VARCHAROID || type == BPCHAROID;
+}
+
+inline
+bool isNumericType( Oid type )
+{
+    return type == INT2OID || type == INT4OID || type == INT8OID
+           || type == FLOAT4OID || type == FLOAT8OID || type == NUMERICOID;
+}
+
+//! values in binary results are in network byte order
+inline
+uint64_t networkValue( const char* data, size_t size )
+{
+    uint64_t value = 0;
+
+    for ( size_t i = 0; i < size; i++ ) {
+        value = ( value << 8 ) | uint64_t( static_cast<unsigned char>( data[i] ) );
+    }
 
-    PostgisConnection( const std::string& connInfo )
-        : _conn( PQconnectdb( connInfo.c_str() ) )
+    return value;
+}
+
+//! decode a numeric value in binary format
+//! @note the type must be one of isNumericType() or a text type
+inline
+double numericValue( const PGresult* res, int row, int col )
+{
+    const char* data = PQgetvalue( res, row, col );
+
+    switch ( PQftype( res, col ) ) {
+    case INT2OID:
+        return int16_t( networkValue( data, 2 ) );
+    case INT4OID:
+        return int32_t( networkValue( data, 4 ) );
+    case INT8OID:
+        return double( int64_t( networkValue( data, 8 ) ) );
+    case FLOAT4OID: {
+        const uint32_t bits = uint32_t( networkValue( data, 4 ) );
+        float value;
+        std::memcpy( &value, &bits, 4 );
+        return value;
+    }
+    case FLOAT8OID: {
+        const uint64_t bits = networkValue( data, 8 );
+        double value;
+        std::memcpy( &value, &bits, 8 );
+        return value;
+    }
+    case NUMERICOID: {
+        // ndigits, weight, sign, dscale then ndigits base 10000 digits, all int16
+        const int ndigits = int16_t( networkValue( data, 2 ) );
+        const int weight  = int16_t( networkValue( data + 2, 2 ) );
+        const unsigned sign = uint16_t( networkValue( data + 4, 2 ) );
+
+        if ( sign == 0xC000 ) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        double value = 0;
+
+        for ( int i = 0; i < ndigits; i++ ) {
+            value += int16_t( networkValue( data + 8 + 2*i, 2 ) ) * std::pow( 10000.0, weight - i );
+        }
+
+        return sign == 0x4000 ? -value : value;
+    }
+    }
+
+    return atof( data ); // text
+}
+
+//! parse a "#rrggbb" or "#rrggbbaa" color
+//! @return false if the text is not a color, color is then unchanged
+inline
+bool parseColor( const char* text, osg::Vec4& color )
+{
+    const size_t len = std::strlen( text );
+
+    if ( text[0] != '#' || ( len != 7 && len != 9 ) ) {
+        return false;
+    }
+
+    float c[4] = { 0, 0, 0, 1 };
+
+    for ( size_t i = 0; 1 + 2*i < len; i++ ) {
+        unsigned value = 0;
+
+        for ( size_t j = 1 + 2*i; j < 3 + 2*i; j++ ) {
+            if ( !std::isxdigit( static_cast<unsigned char>( text[j] ) ) ) {
+                return false;
+            }
+
+            value = value*16 + ( std::isdigit( static_cast<unsigned char>( text[j] ) ) ? text[j] - '0' : std::tolower( text[j] ) - 'a' + 10 );
+        }
+
+        c[i] = value / 255.f;
+    }
+
+    color.set( c[0], c[1], c[2], c[3] );
+    return true;
+}
+
+void MyErrorHandler( CPLErr , int /*err_no*/, const char* msg )
+{
+    throw std::runtime_error( std::string( "from GDAL: " ) + msg );
+}
+
+//! converts rows of query results into the mesh, the columns are
+//! either a geometry, or pos, height, width and optionally color for bars
+//! @note column indices and types are taken from the first result, the following
+//!       ones are expected to have the same columns (rows of single row mode)
+struct FeatureReader {
+    FeatureReader( osgGIS::Mesh& mesh, const std::string& geocolumn )
+        : _mesh( mesh )
+        , _geocolumn( geocolumn )
+        , _initialized( false )
+        , _numFeatures( 0 )
     {}
 
-    operator bool() {
-        return CONNECTION_OK == PQstatus( _conn );
+    //! @return false, error() then gives the reason, if the result columns are not usable
+    bool read( const PGresult* res ) {
+        return read( res, 0, PQntuples( res ) );
     }
 
-    ~PostgisConnection() {
-        if ( _conn ) {
-            PQfinish( _conn );
+    //! read rows [beginRow, endRow) only
+    bool read( const PGresult* res, int beginRow, int endRow ) {
+        if ( !_initialized && !init( res ) ) {
+            return false;
+        }
+
+        if ( _geomIdx >= 0 ) { // we have a geom column, we create the model from it
+            for( int i=beginRow; i<endRow; i++ ) {
+                if ( PQgetisnull( res, i, _geomIdx ) ) {
+                    continue;    // null value from postgres
+                }
+
+                if ( _hex ) {
+                    _mesh.push_back( osgGIS::WKB( PQgetvalue( res, i, _geomIdx ) ) );
+                }
+                else {
+                    _mesh.push_back( osgGIS::RawWKB( reinterpret_cast<const unsigned char*>( PQgetvalue( res, i, _geomIdx ) ),
+                                                     PQgetlength( res, i, _geomIdx ) ) );
+                }
+            }
+        }
+        else { // we draw bars instead of geom
+            for( int i=beginRow; i<endRow; i++ ) {
+                if ( PQgetisnull( res, i, _posIdx )
+                        || PQgetisnull( res, i, _heightIdx )
+                        || PQgetisnull( res, i, _widthIdx ) ) {
+                    continue;    // null value from postgres
+                }
+
+                const float h = numericValue( res, i, _heightIdx );
+                const float w = numericValue( res, i, _widthIdx );
+
+                // material of the layer if there is no color or it cannot be parsed
+                osg::Vec4 color( 0, 0, 0, 0 );
+
+                if ( _colorIdx >= 0 && !PQgetisnull( res, i, _colorIdx ) ) {
+                    parseColor( PQgetvalue( res, i, _colorIdx ), color );
+                }
+
+                if ( _hex ) {
+                    _mesh.addBar( osgGIS::WKB( PQgetvalue( res, i, _posIdx ) ), w, w, h, color );
+                }
+                else {
+                    _mesh.addBar( osgGIS::RawWKB( reinterpret_cast<const unsigned char*>( PQgetvalue( res, i, _posIdx ) ),
+                                                  PQgetlength( res, i, _posIdx ) ), w, w, h, color );
+                }
+            }
         }
+
+        _numFeatures += endRow - beginRow;
+        return true;
     }
 
-    // for RAII ok query results
-    struct QueryResult {
-        QueryResult( PostgisConnection& conn, const std::string& query )
-            : _res( PQexec( conn._conn, query.c_str() ) )
-            , _error( PQresultErrorMessage( _res ) )
-        {}
+    //! make room in the mesh for rows [beginRow, endRow), from the point counts
+    //! of their WKB, to avoid reallocations while they are read
+    //! @note rows of single row mode should not be reserved one by one
+    //! @return false, error() then gives the reason, if the result columns are not usable
+    bool reserve( const PGresult* res, int beginRow, int endRow ) {
+        if ( !_initialized && !init( res ) ) {
+            return false;
+        }
 
-        ~QueryResult() {
-            PQclear( _res );
+        if ( _geomIdx < 0 ) {
+            _mesh.reserveBars( endRow - beginRow );
+            return true;
         }
 
-        operator bool() const {
-            return _error.empty();
+        size_t numVertices = 0;
+        size_t numTriangles = 0;
+
+        for( int i=beginRow; i<endRow; i++ ) {
+            if ( PQgetisnull( res, i, _geomIdx ) ) {
+                continue;
+            }
+
+            if ( _hex ) {
+                // a 2D point takes at least 32 hex characters, decoding is not worth it
+                const size_t numPoints = PQgetlength( res, i, _geomIdx ) / 32;
+                numVertices += numPoints;
+                numTriangles += numPoints;
+            }
+            else {
+                osgGIS::Mesh::estimateSize( osgGIS::RawWKB( reinterpret_cast<const unsigned char*>( PQgetvalue( res, i, _geomIdx ) ),
+                                                            PQgetlength( res, i, _geomIdx ) ), numVertices, numTriangles );
+            }
         }
 
-        PGresult* get() {
-            return _res;
+        _mesh.reserve( numVertices, numTriangles );
+        return true;
+    }
+
+    size_t numFeatures() const {
+        return _numFeatures;
+    }
+
+    const std::string& error() const {
+        return _error;
+    }
+
+private:
+    osgGIS::Mesh& _mesh;
+    const std::string _geocolumn;
+    bool _initialized;
+    size_t _numFeatures;
+    std::string _error;
+    int _geomIdx;
+    int _posIdx;
+    int _heightIdx;
+    int _widthIdx;
+    int _colorIdx;
+    bool _hex; // geometry, bytea are sent as WKB, text is assumed to be hex encoded WKB
+
+    bool init( const PGresult* res ) {
+        _geomIdx   = PQfnumber( res,  _geocolumn.c_str() );
+        _posIdx    = PQfnumber( res,  "pos" );
+        _heightIdx = PQfnumber( res,  "height" );
+        _widthIdx  = PQfnumber( res,  "width" );
+        _colorIdx  = PQfnumber( res,  "color" );
+
+        if ( _geomIdx >= 0 ) {
+            _hex = isTextType( PQftype( res, _geomIdx ) );
         }
+        else if ( _posIdx >= 0 && _heightIdx >= 0 && _widthIdx >=0 ) {
+            const Oid heightType = PQftype( res, _heightIdx );
+            const Oid widthType = PQftype( res, _widthIdx );
+
+            if ( !( isNumericType( heightType ) || isTextType( heightType ) )
+                    || !( isNumericType( widthType ) || isTextType( widthType ) ) ) {
+                _error = "unsupported type for 'height' or 'width' column (cast it to float8)";
+                return false;
+            }
+
+            if ( _colorIdx >= 0 && !isTextType( PQftype( res, _colorIdx ) ) ) {
+                _error = "unsupported type for 'color' column (should be text like '#rrggbb')";
+                return false;
+            }
+
+            _hex = isTextType( PQftype( res, _posIdx ) );
+        }
+        else {
+            _error = "cannot find either '" + _geocolumn + "' column or 'pos','height','width' columns";
+            return false;
+        }
+
+        _initialized = true;
+        return true;
+    }
+};
+
+//! converts a range of rows into its own mesh, in a separate thread
+struct ChunkReader : OpenThreads::Thread {
+    ChunkReader( const osg::Matrixd& layerToWord, osgGIS::Mesh::Triangulator triangulator, bool fullCheck, bool instancedBars,
+                 const std::string& geocolumn, const PGresult* res, int beginRow, int endRow )
+        : mesh( layerToWord, triangulator )
+        , _reader( mesh, geocolumn )
+        , _res( res )
+        , _beginRow( beginRow )
+        , _endRow( endRow ) {
+        mesh.enableFullCheck( fullCheck );
+        mesh.enableInstancedBars( instancedBars );
+    }
 
-        const std::string& error() const {
-            return _error;
+    virtual void run() {
+        // exceptions must not escape the thread, they are rethrown by the caller
+        try {
+            if ( !_reader.reserve( _res, _beginRow, _endRow ) || !_reader.read( _res, _beginRow, _endRow ) ) {
+                error = _reader.error();
+            }
+        }
+        catch ( std::exception& e ) {
+            exception = e.what();
         }
+    }
 
-    private:
-        PGresult* _res;
-        const std::string _error;
-        // non copyable
-        QueryResult( const QueryResult& );
-        QueryResult operator=( const QueryResult& );
-    };
+    osgGIS::Mesh mesh;
+    std::string error;     // unusable columns
+    std::string exception; // failed conversion of a row
 
 private:
-    PGconn* _conn;
+    FeatureReader _reader;
+    const PGresult* const _res;
+    const int _beginRow;
+    const int _endRow;
 };
 
-void MyErrorHandler( CPLErr , int /*err_no*/, const char* msg )
+//! rows are split in contiguous chunks converted concurrently, the chunk meshes
+//! are then appended in row order, so the result does not depend on the number of threads
+//! @throw std::runtime_error if the conversion of a row failed, like the sequential conversion
+//! @return false, error is then set, if the result columns are not usable
+inline
+bool readConcurrently( osgGIS::Mesh& mesh, const osg::Matrixd& layerToWord, osgGIS::Mesh::Triangulator triangulator,
+                       bool fullCheck, bool instancedBars, const std::string& geocolumn, const PGresult* res, int numThreads, std::string& error )
 {
-    throw std::runtime_error( std::string( "from GDAL: " ) + msg );
+    const int numRows = PQntuples( res );
+    const int chunkSize = std::max( 1, ( numRows + numThreads - 1 ) / numThreads );
+
+    std::vector< ChunkReader* > chunks;
+
+    for ( int begin = 0; begin < numRows; begin += chunkSize ) {
+        chunks.push_back( new ChunkReader( layerToWord, triangulator, fullCheck, instancedBars, geocolumn, res, begin, std::min( begin + chunkSize, numRows ) ) );
+        chunks.back()->startThread();
+    }
+
+    std::string exception;
+
+    // the chunks are appended at once, after room is made for all of them
+    size_t numVertices = 0;
+    size_t numTriangles = 0;
+
+    for ( size_t c = 0; c < chunks.size(); c++ ) {
+        chunks[c]->join();
+        numVertices += chunks[c]->mesh.numVertices();
+        numTriangles += chunks[c]->mesh.numTriangles();
+    }
+
+    mesh.reserve( numVertices, numTriangles );
+
+    for ( size_t c = 0; c < chunks.size(); c++ ) {
+        // the first error in row order is reported
+        if ( error.empty() && exception.empty() ) {
+            error = chunks[c]->error;
+            exception = chunks[c]->exception;
+
+            if ( error.empty() && exception.empty() ) {
+                mesh.append( chunks[c]->mesh );
+            }
+        }
+
+        delete chunks[c];
+    }
+
+    if ( !exception.empty() ) {
+        throw std::runtime_error( exception );
+    }
+
+    return error.empty();
+}
+
+typedef std::vector< osg::Vec3 >::iterator VertexIterator;
+
+//! raster georeferencing and value scaling, common to draping functions
+struct ElevationBand {
+    ElevationBand( Dataset& raster, const osg::Vec3d& origin )
+        : band( raster->GetRasterBand( 1 ) )
+        , pixelWidth( raster->GetRasterXSize() )
+        , pixelHeight( raster->GetRasterYSize() )
+        , layerOrigin( origin ) {
+        double transform[6];
+        raster->GetGeoTransform( transform );
+
+        // assume square pixels
+        assert( std::abs( transform[4] ) < FLT_EPSILON );
+        assert( std::abs( transform[2] ) < FLT_EPSILON );
+
+        originX = transform[0];
+        originY = transform[3];
+        pixelPerMetreX =  1.f/transform[1];
+        pixelPerMetreY = -1.f/transform[5]; // image is top->bottom
+
+        int ok;
+        dataOffset = band->GetOffset( &ok );
+
+        if ( ! ok ) {
+            dataOffset = 0.0;
+        }
+
+        dataScale = band->GetScale( &ok );
+
+        if ( ! ok ) {
+            dataScale = 1.0;
+        }
+
+        noData = band->GetNoDataValue( &hasNoData );
+    }
+
+    //! position of the vertex in pixel coordinates (pixel corners are integers)
+    double pixelX( const osg::Vec3& v ) const {
+        return ( v.x() + layerOrigin.x() - originX )*pixelPerMetreX;
+    }
+
+    double pixelY( const osg::Vec3& v ) const {
+        return ( originY - v.y() - layerOrigin.y() )*pixelPerMetreY;
+    }
+
+    float elevation( double value ) const {
+        return float( ( value * dataScale ) + dataOffset - layerOrigin.z() );
+    }
+
+    GDALRasterBand* band;
+    const int pixelWidth;
+    const int pixelHeight;
+    const osg::Vec3d layerOrigin;
+    double originX;
+    double originY;
+    double pixelPerMetreX;
+    double pixelPerMetreY;
+    double dataOffset;
+    double dataScale;
+    double noData;
+    int hasNoData;
+};
+
+//! reads one pixel per vertex, kept to compare timings with drape()
+void drapePerVertex( Dataset& raster, const osg::Vec3d& origin, VertexIterator begin, VertexIterator end )
+{
+    const ElevationBand eb( raster, origin );
+    double value;
+
+    for ( VertexIterator v = begin; v != end; ++v ) {
+        const int posX = int( eb.pixelX( *v ) );
+        const int posY = int( eb.pixelY( *v ) );
+
+        if ( posX >=0 && posX < eb.pixelWidth && posY >= 0 && posY < eb.pixelHeight ) {
+            eb.band->RasterIO( GF_Read, posX, posY, 1, 1, &value, 1, 1, GDT_Float64, 0, 0 );
+            v->z() = eb.elevation( value );
+        }
+    }
+}
+
+//! set vertices altitude from raster
+//! the raster window covering the vertices is read once, or strip by strip
+//! if it's too big, and then sampled in memory
+//! @param bilinear interpolate between pixel centers instead of taking the pixel value
+void drape( Dataset& raster, const osg::Vec3d& origin, bool bilinear, VertexIterator begin, VertexIterator end )
+{
+    const ElevationBand eb( raster, origin );
+
+    // maximum number of pixels read at once (memory is 8 times that)
+    const size_t maxStripPixels = 1 << 22;
+
+    // sample position (x,y) is the pixel at the top left of the sample for bilinear
+    // interpolation (pixel centers are at .5), the pixel containing the vertex otherwise
+    const double shift = bilinear ? .5 : 0;
+
+    // window covering all vertices inside the raster
+    int xmin = eb.pixelWidth, ymin = eb.pixelHeight, xmax = -1, ymax = -1;
+
+    for ( VertexIterator v = begin; v != end; ++v ) {
+        const double px = eb.pixelX( *v );
+        const double py = eb.pixelY( *v );
+
+        if ( px >= 0 && px < eb.pixelWidth && py >= 0 && py < eb.pixelHeight ) {
+            const int x = std::max( 0, int( std::floor( px - shift ) ) );
+            const int y = std::max( 0, int( std::floor( py - shift ) ) );
+            xmin = std::min( xmin, x );
+            ymin = std::min( ymin, y );
+            xmax = std::max( xmax, x );
+            ymax = std::max( ymax, y );
+        }
+    }
+
+    if ( xmax < 0 ) {
+        return;    // no vertex inside the raster
+    }
+
+    // bilinear needs the next pixel too
+    if ( bilinear ) {
+        xmax = std::min( xmax + 1, eb.pixelWidth - 1 );
+        ymax = std::min( ymax + 1, eb.pixelHeight - 1 );
+    }
+
+    const int width = xmax - xmin + 1;
+
+    // rows in a strip, the last row of a strip is also the first of the next one
+    // for bilinear interpolation
+    const int overlap = bilinear ? 1 : 0;
+
+    const int stripRows = std::max( 1 + overlap, int( maxStripPixels / width ) );
+
+    const int stripStep = stripRows - overlap;
+
+    std::vector< double > strip;
+
+    // vertices are processed strip by strip, in most cases (tiles) there is only one strip
+    const int numStrips = std::max( 1, ( ymax - ymin - overlap ) / stripStep + 1 );
+
+    std::vector< std::vector< osg::Vec3* > > stripVertices( numStrips );
+
+    for ( VertexIterator v = begin; v != end; ++v ) {
+        const double px = eb.pixelX( *v );
+        const double py = eb.pixelY( *v );
+
+        if ( px >= 0 && px < eb.pixelWidth && py >= 0 && py < eb.pixelHeight ) {
+            const int y = std::max( 0, int( std::floor( py - shift ) ) );
+            stripVertices[ std::min( numStrips - 1, ( y - ymin ) / stripStep ) ].push_back( &( *v ) );
+        }
+    }
+
+    for ( int s = 0; s < numStrips; s++ ) {
+        if ( stripVertices[s].empty() ) {
+            continue;
+        }
+
+        const int y0 = ymin + s * stripStep;
+        const int height = std::min( stripRows, ymax - y0 + 1 );
+        strip.resize( size_t( width ) * height );
+        eb.band->RasterIO( GF_Read, xmin, y0, width, height, &strip[0], width, height, GDT_Float64, 0, 0 );
+
+        const size_t numVertices = stripVertices[s].size();
+
+        for ( size_t i = 0; i < numVertices; i++ ) {
+            osg::Vec3& v = *stripVertices[s][i];
+            const double px = eb.pixelX( v ) - shift;
+            const double py = eb.pixelY( v ) - shift;
+
+            if ( !bilinear ) {
+                v.z() = eb.elevation( strip[ ( int( py ) - y0 ) * width + int( px ) - xmin ] );
+                continue;
+            }
+
+            // clamp on raster borders
+            const int x = std::max( 0, int( std::floor( px ) ) );
+            const int y = std::max( 0, int( std::floor( py ) ) );
+            const int x1 = std::min( x + 1, xmax );
+            const int y1 = std::min( y + 1, y0 + height - 1 );
+            const double fx = std::min( 1.0, std::max( 0.0, px - x ) );
+            const double fy = std::min( 1.0, std::max( 0.0, py - y ) );
+
+            const double z00 = strip[ ( y  - y0 ) * width + x  - xmin ];
+            const double z10 = strip[ ( y  - y0 ) * width + x1 - xmin ];
+            const double z01 = strip[ ( y1 - y0 ) * width + x  - xmin ];
+            const double z11 = strip[ ( y1 - y0 ) * width + x1 - xmin ];
+
+            if ( eb.hasNoData && ( z00 == eb.noData || z10 == eb.noData || z01 == eb.noData || z11 == eb.noData ) ) {
+                // don't mix nodata with actual values, take the nearest pixel instead
+                const double nearest = ( fy < .5 ) ? ( fx < .5 ? z00 : z10 ) : ( fx < .5 ? z01 : z11 );
+                v.z() = eb.elevation( nearest );
+                continue;
+            }
+
+            v.z() = eb.elevation( ( 1 - fy ) * ( ( 1 - fx ) * z00 + fx * z10 )
+                                  + fy * ( ( 1 - fx ) * z01 + fx * z11 ) );
+        }
+    }
 }
 
 struct ReaderWriterPOSTGIS : osgDB::ReaderWriter {
@@ -152,32 +669,59 @@ struct ReaderWriterPOSTGIS : osgDB::ReaderWriter {
         std::stringstream line( file_name );
         AttributeMap am( line );
 
-        PostgisConnection conn( am.value( "conn_info" ) );
+        // tiles already built are read from the disk cache, without connecting to the database,
+        // the key is made of all the attributes but the cache ones and those that only
+        // change how the tile is loaded
+        double cacheSizeMb = 1024;
 
-        if ( !conn ) {
-            std::cerr << "failed to open database with conn_info=\"" << am.value( "conn_info" ) << "\"\n";
-            return ReadResult::FILE_NOT_FOUND;
+        if ( !am.optionalValue( "cache_size" ).empty()
+                && ( !( std::istringstream( am.value( "cache_size" ) ) >> cacheSizeMb ) || cacheSizeMb <= 0 ) ) {
+            std::cerr << "failed to parse cache_size=\"" << am.value( "cache_size" ) << "\" (in MB)\n";
+            return ReadResult::ERROR_IN_READING_FILE;
         }
 
-        DEBUG_OUT << "connected in " <<  timer.time_s() << "sec\n";
+        const osgGIS::TileCache cache( am.optionalValue( "cache_dir" ), uint64_t( cacheSizeMb * 1024 * 1024 ) );
+        AttributeMap keyAttributes( am );
+        keyAttributes.removeValue( "threads" );
+        keyAttributes.removeValue( "pool_size" );
+        keyAttributes.removeValue( "pool_idle_timeout" );
+        keyAttributes.removeValue( "streaming" );
+        const std::string cacheKey = keyAttributes.toString( "cache_" );
+
+        if ( !am.optionalValue( "cache_dir" ).empty() ) {
+            timer.setStartTick();
+            osg::ref_ptr< osg::Node > cached = cache.read( cacheKey );
+
+            if ( cached.valid() ) {
+                osgGIS::Mesh::restoreInstancedBars( *cached );
+                DEBUG_OUT << "read " << cache.path( cacheKey ) << " from cache in " << timer.time_s() << "sec\n";
+                return cached.release();
+            }
+        }
 
-        DEBUG_OUT << "execute request...\n";
-        timer.setStartTick();
+        if ( !am.optionalValue( "pool_size" ).empty() || !am.optionalValue( "pool_idle_timeout" ).empty() ) {
+            size_t poolSize = 8;
+            double idleTimeout = 60;
 
-        PostgisConnection::QueryResult res( conn, am.value( "query" ).c_str() );
+            if ( ( !am.optionalValue( "pool_size" ).empty() && !( std::istringstream( am.value( "pool_size" ) ) >> poolSize ) )
+                    || ( !am.optionalValue( "pool_idle_timeout" ).empty() && !( std::istringstream( am.value( "pool_idle_timeout" ) ) >> idleTimeout ) ) ) {
+                std::cerr << "failed to parse pool_size=\"" << am.optionalValue( "pool_size" )
+                          << "\" or pool_idle_timeout=\"" << am.optionalValue( "pool_idle_timeout" ) << "\"\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
 
-        if ( !res ) {
-            std::cerr << "failed to execute query=\"" <<  am.value( "query" ) << "\" : " << res.error() << "\n";
-            return ReadResult::ERROR_IN_READING_FILE;
+            osgGIS::ConnectionPool::instance().configure( poolSize, idleTimeout );
         }
 
-        const int numFeatures = PQntuples( res.get() );
+        osgGIS::PooledConnection conn( am.value( "conn_info" ) );
 
-        DEBUG_OUT << "got " << numFeatures << " features in " << timer.time_s() << "sec\n";
-
-        DEBUG_OUT << "converting " << numFeatures << " features from postgis...\n";
+        if ( !conn ) {
+            std::cerr << "failed to open database with conn_info=\"" << am.value( "conn_info" ) << "\"\n";
+            return ReadResult::FILE_NOT_FOUND;
+        }
 
-        timer.setStartTick();
+        DEBUG_OUT << "connected in " <<  timer.time_s() << "sec (pool hits " << osgGIS::ConnectionPool::instance().hits()
+                  << ", misses " << osgGIS::ConnectionPool::instance().misses() << ")\n";
 
         // define transfo  layerToWord
         osg::Matrixd layerToWord;
@@ -195,103 +739,250 @@ struct ReaderWriterPOSTGIS : osgDB::ReaderWriter {
 
         const std::string geocolumn = am.optionalValue( "geocolumn" ).empty() ? "geom" : am.value( "geocolumn" );
 
-        const int geomIdx   = PQfnumber( res.get(),  geocolumn.c_str() );
+        // tile bbox, parameters $1..$4 of the query, the query is then prepared
+        // once per connection instead of being planned for each tile
+        osgGIS::PostgisConnection::Parameters params;
 
-        const int posIdx    = PQfnumber( res.get(),  "pos" );
+        if ( !am.optionalValue( "tile" ).empty() ) {
+            std::stringstream tile( am.value( "tile" ) );
+            double bound;
 
-        const int heightIdx = PQfnumber( res.get(),  "height" );
+            while ( tile >> bound ) {
+                std::stringstream param;
+                param << std::setprecision( 16 ) << bound;
+                params.push_back( param.str() );
+            }
 
-        const int widthIdx  = PQfnumber( res.get(),  "width" );
+            if ( !tile.eof() || params.size() != 4 ) {
+                std::cerr << "failed to parse tile=\"" << am.value( "tile" ) << "\"\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+        }
 
-        osgGIS::Mesh mesh( layerToWord );
+        // rows of a materialized result can be converted concurrently
+        int numThreads = 1;
 
-        if ( geomIdx >= 0 ) { // we have a geom column, we create the model from it
-            for( int i=0; i<numFeatures; i++ ) {
-                osgGIS::WKB wkb( PQgetvalue( res.get(), i, geomIdx ) );
-                assert( wkb.get() );
+        if ( !am.optionalValue( "threads" ).empty()
+                && ( !( std::istringstream( am.value( "threads" ) ) >> numThreads ) || numThreads < 1 ) ) {
+            std::cerr << "failed to parse threads=\"" << am.value( "threads" ) << "\"\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
 
-                if ( !*wkb.get() ) {
-                    continue;    // null value from postgres
+        // streamed rows are converted one at a time, as they arrive
+        if ( numThreads > 1 && "true" == am.optionalValue( "streaming" ) ) {
+            std::cerr << "threads=\"" << am.value( "threads" ) << "\" cannot be used with streaming=\"true\"\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        // glu by default, cdt gives better shaped triangles
+        osgGIS::Mesh::Triangulator triangulator = osgGIS::Mesh::GLU;
+
+        if ( "cdt" == am.optionalValue( "triangulator" ) ) {
+            triangulator = osgGIS::Mesh::CDT;
+        }
+        else if ( !am.optionalValue( "triangulator" ).empty() && "glu" != am.value( "triangulator" ) ) {
+            std::cerr << "failed to parse triangulator=\"" << am.value( "triangulator" ) << "\", should be glu or cdt\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        // validation of polygons before poly2tri, can be skipped for trusted data
+        const bool fullCheck = "false" != am.optionalValue( "full_check" );
+
+        // bars are drawn as instances of a single box instead of a box each
+        bool instancedBars = false;
+
+        if ( "instanced" == am.optionalValue( "bars" ) ) {
+            instancedBars = true;
+        }
+        else if ( !am.optionalValue( "bars" ).empty() && "mesh" != am.value( "bars" ) ) {
+            std::cerr << "failed to parse bars=\"" << am.value( "bars" ) << "\", should be mesh or instanced\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        // float: one geometry with float arrays, compact: 16 bits indices and packed normals,
+        // quantized: compact with 16 bits positions
+        const std::string vertexFormat = am.optionalValue( "vertex_format" ).empty() ? "float" : am.value( "vertex_format" );
+
+        if ( "float" != vertexFormat && "compact" != vertexFormat && "quantized" != vertexFormat ) {
+            std::cerr << "failed to parse vertex_format=\"" << vertexFormat << "\", should be float, compact or quantized\n";
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        osgGIS::Mesh mesh( layerToWord, triangulator );
+        mesh.enableFullCheck( fullCheck );
+        mesh.enableInstancedBars( instancedBars );
+
+        FeatureReader reader( mesh, geocolumn );
+
+        DEBUG_OUT << "execute request...\n";
+        timer.setStartTick();
+
+        if ( "true" == am.optionalValue( "streaming" ) ) {
+            // rows are converted as they arrive
+            osgGIS::PostgisConnection::RowStream stream( *conn, am.value( "query" ), params );
+
+            while ( stream.next() ) {
+                if ( !reader.read( stream.get() ) ) {
+                    std::cerr << reader.error() << "\n";
+                    return ReadResult::ERROR_IN_READING_FILE;
                 }
+            }
 
-                mesh.push_back( wkb );
+            if ( !stream ) {
+                std::cerr << "failed to execute query=\"" <<  am.value( "query" ) << "\" : " << stream.error() << "\n";
+                return ReadResult::ERROR_IN_READING_FILE;
             }
+
+            DEBUG_OUT << "got and converted " << reader.numFeatures() << " features in " << timer.time_s() << "sec\n";
         }
-        else if ( posIdx >= 0 && heightIdx >= 0 && widthIdx >=0 ) { // we draw bars instead of geom
-            for( int i=0; i<numFeatures; i++ ) {
-                const float h = atof( PQgetvalue( res.get(), i, heightIdx ) );
-                const float w = atof( PQgetvalue( res.get(), i, widthIdx ) );
-                osgGIS::WKB wkb( PQgetvalue( res.get(), i, posIdx ) );
-                assert( wkb.get() );
+        else {
+            osgGIS::PostgisConnection::QueryResult res( *conn, am.value( "query" ), params );
 
-                if ( !*wkb.get() ) {
-                    continue;    // null value from postgres
+            if ( !res ) {
+                std::cerr << "failed to execute query=\"" <<  am.value( "query" ) << "\" : " << res.error() << "\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+
+            DEBUG_OUT << "got " << PQntuples( res.get() ) << " features in " << timer.time_s() << "sec\n";
+
+            timer.setStartTick();
+
+            if ( numThreads > 1 ) {
+                std::string error;
+
+                if ( !readConcurrently( mesh, layerToWord, triangulator, fullCheck, instancedBars, geocolumn, res.get(), numThreads, error ) ) {
+                    std::cerr << error << "\n";
+                    return ReadResult::ERROR_IN_READING_FILE;
+                }
+
+                DEBUG_OUT << "converted " << PQntuples( res.get() ) << " features with " << numThreads << " threads in " << timer.time_s() << "sec\n";
+            }
+            else {
+                if ( !reader.reserve( res.get(), 0, PQntuples( res.get() ) ) || !reader.read( res.get() ) ) {
+                    std::cerr << reader.error() << "\n";
+                    return ReadResult::ERROR_IN_READING_FILE;
                 }
 
-                mesh.addBar( wkb, w, w, h );
+                DEBUG_OUT << "converted " << reader.numFeatures() << " features in " << timer.time_s() << "sec\n";
             }
         }
-        else {
-            std::cerr << "cannot find either 'geom' column or 'height','width' columns\n";
-            return ReadResult::ERROR_IN_READING_FILE;
+
+        if ( !am.optionalValue( "weld" ).empty() ) {
+            float tolerance;
+
+            if ( !( std::istringstream( am.value( "weld" ) ) >> tolerance ) || tolerance <= 0 ) {
+                std::cerr << "failed to parse weld=\"" << am.value( "weld" ) << "\"\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+
+            timer.setStartTick();
+            const size_t numVertices = mesh.numVertices();
+            mesh.weld( tolerance );
+            DEBUG_OUT << "welded " << numVertices << " vertices into " << mesh.numVertices() << " in " << timer.time_s() << "sec\n";
         }
 
-        osg::ref_ptr< osg::Geometry > geom = mesh.createGeometry();
+        DEBUG_OUT << "triangulated " << mesh.tessellationStats().fan << " convex polygons directly, "
+                  << mesh.tessellationStats().cdt << " with poly2tri and "
+                  << mesh.tessellationStats().glu << " with glu (" << mesh.tessellationStats().fallback << " after poly2tri failed)\n";
+
+        osg::ref_ptr< osg::Geometry > bars = mesh.createInstancedBars();
 
         if ( !am.optionalValue( "elevation" ).empty() ) {
+            timer.setStartTick();
+
             Dataset raster( am.value( "elevation" ).c_str() );
-            double transform[6];
-            raster->GetGeoTransform( transform );
-            const int pixelWidth = raster->GetRasterXSize();
-            const int pixelHeight = raster->GetRasterYSize();
 
-            // assume square pixels
-            assert( std::abs( transform[4] ) < FLT_EPSILON );
-            assert( std::abs( transform[2] ) < FLT_EPSILON );
+            if ( !raster ) {
+                std::cerr << "failed to open elevation=\"" << am.value( "elevation" ) << "\"\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
 
-            const double originX = transform[0];
-            const double originY = transform[3];
+            // vertices are draped before the geometry is created, since it may quantize them
+            std::vector< osg::Vec3 >& vtx = mesh.vertices();
 
-            const double pixelPerMetreX =  1.f/transform[1];
-            const double pixelPerMetreY = -1.f/transform[5]; // image is top->bottom
-            GDALRasterBand* band = raster->GetRasterBand( 1 );
-            GDALDataType dType = band->GetRasterDataType();
-            const int dSizeBits = GDALGetDataTypeSize( dType );
-            std::vector<char> buffer( dSizeBits / 8  );
-            char* blockData = &buffer[0];
+            const std::string sampling = am.optionalValue( "elevation_sampling" ).empty() ? "nearest" : am.value( "elevation_sampling" );
 
-            double dataOffset;
-            int ok;
-            dataOffset = band->GetOffset( &ok );
+            if ( "per_vertex" == sampling ) {
+                drapePerVertex( raster, origin, vtx.begin(), vtx.end() );
+            }
+            else if ( "nearest" == sampling || "bilinear" == sampling ) {
+                drape( raster, origin, "bilinear" == sampling, vtx.begin(), vtx.end() );
+            }
+            else {
+                std::cerr << "unknown elevation_sampling=\"" << sampling << "\" (nearest, bilinear or per_vertex)\n";
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+
+            // the base of the instanced bars sits on the ground
+            if ( bars.valid() ) {
+                osg::Vec3Array* pos = dynamic_cast<osg::Vec3Array*>( bars->getVertexAttribArray( osgGIS::Mesh::BAR_POSITION ) );
+
+                assert( pos );
+
+                if ( "per_vertex" == sampling ) {
+                    drapePerVertex( raster, origin, pos->begin(), pos->end() );
+                }
+                else {
+                    drape( raster, origin, "bilinear" == sampling, pos->begin(), pos->end() );
+                }
 
-            if ( ! ok ) {
-                dataOffset = 0.0;
+                // the initial bound, saved in cached tiles, is computed again
+                bars->setInitialBound( osg::BoundingBox() );
+                bars->setInitialBound( bars->getBound() );
             }
 
-            const double dataScale = band->GetScale( &ok );
+            DEBUG_OUT << "draped " << vtx.size() << " vertices (" << sampling << ") in " << timer.time_s() << "sec\n";
+        }
 
-            assert( ok );
+        if ( bars.valid() ) {
+            DEBUG_OUT << "instanced " << mesh.numBars() << " bars\n";
+        }
 
-            osg::Vec3Array* vtx = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
+        timer.setStartTick();
 
-            assert( vtx );
+        osg::ref_ptr< osg::Node > node;
 
-            for ( osg::Vec3Array::iterator v = vtx->begin(); v!=vtx->end(); v++ ) {
-                const int posX = int( ( v->x() + origin.x() - originX )*pixelPerMetreX );
-                const int posY = int( ( originY - v->y() - origin.y() )*pixelPerMetreY );
+        if ( "float" == vertexFormat ) {
+            // the mesh is not used afterward, its buffers are moved in the geometry
+            osg::ref_ptr< osg::Geometry > geom = mesh.releaseGeometry();
 
-                if ( posX >=0 && posX < pixelWidth && posY >= 0 && posY < pixelHeight ) {
-                    band->RasterIO( GF_Read, posX, posY, 1, 1, blockData, 1, 1, dType, 0, 0 );
-                    v->z() = float( ( SRCVAL( blockData, dType, 0 ) * dataScale )  + dataOffset ) - origin.z();
-                }
+            osg::ref_ptr<osg::Geode> group = new osg::Geode();
+            group->addDrawable( geom.get() );
+
+            if ( bars.valid() ) {
+                group->addDrawable( bars.get() );
             }
+
+            node = group.get();
         }
+        else {
+            osg::ref_ptr<osg::Group> group = new osg::Group();
+            group->addChild( mesh.createCompactGeometry( "quantized" == vertexFormat ) );
 
-        DEBUG_OUT << "converted " << numFeatures << " features in " << timer.time_s() << "sec\n";
+            if ( bars.valid() ) {
+                osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+                geode->addDrawable( bars.get() );
+                group->addChild( geode.get() );
+            }
+
+            node = group.get();
+        }
+
+        DEBUG_OUT << "created " << vertexFormat << " geometry in " << timer.time_s() << "sec\n";
+
+        if ( !am.optionalValue( "cache_dir" ).empty() ) {
+            timer.setStartTick();
+
+            // the tile is still usable if it cannot be cached
+            if ( !cache.write( cacheKey, *node ) ) {
+                std::cerr << "failed to write " << cache.path( cacheKey ) << " in cache_dir=\"" << am.value( "cache_dir" ) << "\"\n";
+            }
+            else {
+                DEBUG_OUT << "wrote " << cache.path( cacheKey ) << " in cache in " << timer.time_s() << "sec\n";
+            }
+        }
 
-        osg::ref_ptr<osg::Geode> group = new osg::Geode();
-        group->addDrawable( geom.get() );
-        return group.release();
+        return node.release();
     }
 };
 
@@ -18,6 +18,14 @@
  */
 #include "SFosg.h"
 
+#include <osg/Timer>
+#include <osg/Vec2d>
+#include <osg/Program>
+#include <osg/Shader>
+#include <osg/VertexAttribDivisor>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
+
 #include <GL/glu.h>
 
 extern "C" {
@@ -31,17 +39,17 @@ extern "C" {
 #include <boost/noncopyable.hpp>
 
 #include <iostream>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
 
 // poly2tri gives better triangulation (delauny) than GLUtesselator
-// in about twice the time (wich is really good)
-// but since it's not robust, even with valid geometries (touching rings),
-// we keep it for latter use
-//#define POLY2TRI
-#ifdef POLY2TRI
+// in about twice the time (wich is really good), but since it's not robust,
+// even with valid geometries, polygons it fails on are given to GLU
 #include "../poly2tri/poly2tri.h"
-#include <memory>
-#include <iomanip>
-#endif
 
 namespace osgGIS {
 
@@ -74,6 +82,25 @@ const struct LwgeomInitialiser {
 } iAmJustAnInstanceSuchThatTheCtorIsExecuted;
 
 
+//! @return the value of an hex digit, -1 if it's not one
+inline
+int hexValue( char c )
+{
+    if ( c >= '0' && c <= '9' ) {
+        return c - '0';
+    }
+
+    if ( c >= 'A' && c <= 'F' ) {
+        return c - 'A' + 10;
+    }
+
+    if ( c >= 'a' && c <= 'f' ) {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
 // utility class for RAII of LWGEOM
 struct Lwgeom {
     Lwgeom( WKT wkt )
@@ -82,6 +109,9 @@ struct Lwgeom {
     Lwgeom( WKB wkb )
         : _geom( lwgeom_from_hexwkb( wkb.get(), LW_PARSER_CHECK_NONE ) )
     {}
+    Lwgeom( RawWKB wkb )
+        : _geom( lwgeom_from_wkb( wkb.get(), wkb.size(), LW_PARSER_CHECK_NONE ) )
+    {}
     operator bool() const {
         return _geom;
     }
@@ -100,6 +130,400 @@ private:
     LWGEOM* _geom;
 };
 
+//! adds the time elapsed until destruction, or stop(), to total if enabled
+struct ScopedTiming {
+    ScopedTiming( bool enabled, double& total )
+        : _total( enabled ? &total : NULL )
+        , _start( enabled ? osg::Timer::instance()->tick() : 0 )
+    {}
+
+    ~ScopedTiming() {
+        stop();
+    }
+
+    void stop() {
+        if ( _total ) {
+            *_total += osg::Timer::instance()->delta_s( _start, osg::Timer::instance()->tick() );
+            _total = NULL;
+        }
+    }
+
+private:
+    double* _total;
+    const osg::Timer_t _start;
+};
+
+//! ring of a liblwgeom polygon or triangle
+struct LwRing {
+    LwRing( const POINTARRAY* points ): _points( points ) {}
+
+    //! number of points, including the closing one
+    int size() const {
+        return _points->npoints;
+    }
+
+    int ndims() const {
+        return FLAGS_NDIMS( _points->flags );
+    }
+
+    bool hasZ() const {
+        return FLAGS_GET_Z( _points->flags );
+    }
+
+    //! @return contiguous coordinates, ndims() per point, in layer CRS
+    //! @note liblwgeom stores them contiguous and aligned, buffer is not used
+    const double* coordinates( std::vector< double >& /*buffer*/ ) const {
+        return reinterpret_cast< const double* >( getPoint_internal( _points, 0 ) );
+    }
+
+private:
+    const POINTARRAY* _points;
+};
+
+//! gives access to the rings of a liblwgeom polygon
+//! @note this is the interface used by Mesh::addPolygon, also implemented by WkbPolygon
+struct LwPolygon {
+    typedef LwRing Ring;
+
+    LwPolygon( const LWPOLY* lwpoly ): _lwpoly( lwpoly ) {}
+
+    int numRings() const {
+        return _lwpoly->nrings;
+    }
+
+    const Ring ring( int r ) const {
+        return Ring( _lwpoly->rings[r] );
+    }
+
+    bool hasZ() const {
+        return FLAGS_GET_Z( _lwpoly->flags );
+    }
+
+private:
+    const LWPOLY* _lwpoly;
+};
+
+inline
+bool hostIsLittleEndian()
+{
+    const uint16_t one = 1;
+    return *reinterpret_cast< const unsigned char* >( &one ) == 1;
+}
+
+//! @param swap true if the byte order of data is not the host one
+template< typename T >
+T readWkbValue( const unsigned char* data, bool swap )
+{
+    unsigned char bytes[sizeof( T )];
+
+    if ( swap ) {
+        std::reverse_copy( data, data + sizeof( T ), bytes );
+    }
+    else {
+        std::copy( data, data + sizeof( T ), bytes );
+    }
+
+    T value;
+    std::memcpy( &value, bytes, sizeof( T ) );
+    return value;
+}
+
+//! ring read in place from WKB
+struct WkbRing {
+    WkbRing( const unsigned char* points, int size, int ndims, bool swap, bool hasZ )
+        : _points( points )
+        , _size( size )
+        , _ndims( ndims )
+        , _swap( swap )
+        , _hasZ( hasZ )
+    {}
+
+    int size() const {
+        return _size;
+    }
+
+    int ndims() const {
+        return _ndims;
+    }
+
+    bool hasZ() const {
+        return _hasZ;
+    }
+
+    //! @return contiguous coordinates, ndims() per point, in layer CRS
+    //! @note WKB is not aligned and may not be in host byte order, coordinates are copied in buffer
+    const double* coordinates( std::vector< double >& buffer ) const {
+        const size_t n = size_t( _size ) * _ndims;
+        buffer.resize( n );
+
+        if ( n ) {
+            std::memcpy( &buffer[0], _points, n * sizeof( double ) );
+        }
+
+        if ( _swap ) {
+            unsigned char* bytes = reinterpret_cast< unsigned char* >( &buffer[0] );
+
+            for ( size_t i = 0; i < n; i++ ) {
+                std::reverse( bytes + i * sizeof( double ), bytes + ( i + 1 ) * sizeof( double ) );
+            }
+        }
+
+        return n ? &buffer[0] : NULL;
+    }
+
+private:
+    const unsigned char* _points;
+    int _size;
+    int _ndims;
+    bool _swap;
+    bool _hasZ;
+};
+
+//! polygon read in place from WKB, the bounds have been checked by WkbStream
+//! @note rings have variable sizes, the position of the last ring accessed is kept
+//!       so that accessing rings in order is not quadratic
+struct WkbPolygon {
+    typedef WkbRing Ring;
+
+    WkbPolygon( const unsigned char* rings, int numRings, int ndims, bool swap, bool hasZ )
+        : _rings( rings )
+        , _numRings( numRings )
+        , _ndims( ndims )
+        , _swap( swap )
+        , _hasZ( hasZ )
+        , _current( 0 )
+        , _currentPosition( rings )
+    {}
+
+    int numRings() const {
+        return _numRings;
+    }
+
+    const Ring ring( int r ) const {
+        assert( r < _numRings );
+
+        if ( r < _current ) {
+            _current = 0;
+            _currentPosition = _rings;
+        }
+
+        for ( ; _current < r; ++_current ) {
+            _currentPosition += sizeof( uint32_t ) + readWkbValue< uint32_t >( _currentPosition, _swap ) * _ndims * sizeof( double );
+        }
+
+        return Ring( _currentPosition + sizeof( uint32_t ), readWkbValue< uint32_t >( _currentPosition, _swap ), _ndims, _swap, _hasZ );
+    }
+
+    bool hasZ() const {
+        return _hasZ;
+    }
+
+private:
+    const unsigned char* _rings;
+    int _numRings;
+    int _ndims;
+    bool _swap;
+    bool _hasZ;
+    mutable int _current;
+    mutable const unsigned char* _currentPosition;
+};
+
+//! cursor on WKB, or postgis EWKB, data
+struct WkbStream {
+    // geometry types handled without liblwgeom
+    enum Type {
+        POLYGON = 3,
+        MULTIPOLYGON = 6,
+        POLYHEDRALSURFACE = 15,
+        TIN = 16,
+        TRIANGLE = 17
+    };
+
+    WkbStream( const unsigned char* data, size_t size )
+        : _cur( data )
+        , _end( data + size )
+        , _swap( false )
+        , _hasZ( false )
+        , _ndims( 2 )
+    {}
+
+    //! reads the byte order and the type of the next geometry
+    //! @return the geometry type, without dimension flags
+    uint32_t header() {
+        need( 1 + sizeof( uint32_t ) );
+        const bool littleEndian = *_cur++ == 1;
+        _swap = littleEndian != hostIsLittleEndian();
+        const uint32_t type = readUInt32();
+
+        // EWKB flags
+        const uint32_t Z_FLAG = 0x80000000;
+        const uint32_t M_FLAG = 0x40000000;
+        const uint32_t SRID_FLAG = 0x20000000;
+
+        if ( type & SRID_FLAG ) {
+            need( sizeof( uint32_t ) );
+            _cur += sizeof( uint32_t );
+        }
+
+        // ISO WKB types: 1000 for Z, 2000 for M, 3000 for ZM
+        const uint32_t isoType = type & 0x0FFFFFFF;
+        const uint32_t isoDims = isoType / 1000;
+        _hasZ = ( type & Z_FLAG ) || isoDims == 1 || isoDims == 3;
+        const bool hasM = ( type & M_FLAG ) || isoDims == 2 || isoDims == 3;
+        _ndims = 2 + _hasZ + hasM;
+        return isoType % 1000;
+    }
+
+    //! @return true if the geometry at the cursor is of a type handled without liblwgeom
+    bool handled() const {
+        WkbStream peek( *this );
+
+        switch ( peek.header() ) {
+        case POLYGON:
+        case MULTIPOLYGON:
+        case POLYHEDRALSURFACE:
+        case TIN:
+        case TRIANGLE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    uint32_t readUInt32() {
+        need( sizeof( uint32_t ) );
+        const uint32_t value = readWkbValue< uint32_t >( _cur, _swap );
+        _cur += sizeof( uint32_t );
+        return value;
+    }
+
+    //! skips the rings of a polygon (or triangle)
+    //! @return the number of points of each ring, without the closing one, summed
+    //!         in numPoints, and the number of rings
+    uint32_t skipPolygon( size_t& numPoints ) {
+        const uint32_t numRings = readUInt32();
+
+        for ( uint32_t r = 0; r < numRings; r++ ) {
+            const uint32_t n = readUInt32();
+            need( size_t( n ) * _ndims * sizeof( double ) );
+            _cur += size_t( n ) * _ndims * sizeof( double );
+            numPoints += n ? n - 1 : 0;
+        }
+
+        return numRings;
+    }
+
+    //! reads the rings of a polygon (or triangle) and checks they are in bounds
+    const WkbPolygon polygon() {
+        const uint32_t numRings = readUInt32();
+        const unsigned char* rings = _cur;
+
+        for ( uint32_t r = 0; r < numRings; r++ ) {
+            const uint32_t numPoints = readUInt32();
+            need( size_t( numPoints ) * _ndims * sizeof( double ) );
+            _cur += size_t( numPoints ) * _ndims * sizeof( double );
+        }
+
+        return WkbPolygon( rings, numRings, _ndims, _swap, _hasZ );
+    }
+
+private:
+    const unsigned char* _cur;
+    const unsigned char* const _end;
+    bool _swap;
+    bool _hasZ;
+    int _ndims;
+
+    void need( size_t bytes ) const {
+        if ( size_t( _end - _cur ) < bytes ) {
+            throw std::runtime_error( "truncated WKB" );
+        }
+    }
+};
+
+//! writes x,y,z of n points in out, z is 0 if the input has no z
+//! @note the number of dimensions is a template parameter, and the translation
+//!       case is separated, for the loops to be vectorized
+template< int NDIMS, typename REAL >
+void transformPoints( const osg::Matrixd& m, bool translation, const double* in, size_t n, bool hasZ, REAL* out )
+{
+    if ( translation ) {
+        const double tx = m( 3, 0 );
+        const double ty = m( 3, 1 );
+        const double tz = m( 3, 2 );
+
+        if ( hasZ ) {
+            for ( size_t i = 0; i < n; i++ ) {
+                out[3*i]   = REAL( in[NDIMS*i]   + tx );
+                out[3*i+1] = REAL( in[NDIMS*i+1] + ty );
+                out[3*i+2] = REAL( in[NDIMS*i+2] + tz );
+            }
+        }
+        else {
+            for ( size_t i = 0; i < n; i++ ) {
+                out[3*i]   = REAL( in[NDIMS*i]   + tx );
+                out[3*i+1] = REAL( in[NDIMS*i+1] + ty );
+                out[3*i+2] = REAL( tz );
+            }
+        }
+    }
+    else {
+        // osg convention: row vector times matrix
+        for ( size_t i = 0; i < n; i++ ) {
+            const double x = in[NDIMS*i];
+            const double y = in[NDIMS*i+1];
+            const double z = hasZ ? in[NDIMS*i+2] : 0;
+            out[3*i]   = REAL( x * m( 0, 0 ) + y * m( 1, 0 ) + z * m( 2, 0 ) + m( 3, 0 ) );
+            out[3*i+1] = REAL( x * m( 0, 1 ) + y * m( 1, 1 ) + z * m( 2, 1 ) + m( 3, 1 ) );
+            out[3*i+2] = REAL( x * m( 0, 2 ) + y * m( 1, 2 ) + z * m( 2, 2 ) + m( 3, 2 ) );
+        }
+    }
+}
+
+//! @return true if the matrix is only a translation (like the layer origin)
+inline
+bool isTranslation( const osg::Matrixd& m )
+{
+    for ( int i = 0; i < 3; i++ ) {
+        for ( int j = 0; j < 4; j++ ) {
+            if ( m( i, j ) != ( i == j ? 1 : 0 ) ) {
+                return false;
+            }
+        }
+    }
+
+    return m( 3, 3 ) == 1 && m( 0, 3 ) == 0 && m( 1, 3 ) == 0 && m( 2, 3 ) == 0;
+}
+
+//! transform the first count points of the ring from layer to world, in double precision,
+//! the conversion to REAL happens at the end
+//! @param out count*3 values
+//! @param buffer for rings whose coordinates are not contiguous in memory
+template< typename RING, typename REAL >
+void transformRing( const RING& ring, int count, const osg::Matrixd& layerToWord, std::vector< double >& buffer, REAL* out )
+{
+    if ( count <= 0 ) {
+        return;
+    }
+
+    const double* in = ring.coordinates( buffer );
+    const bool translation = isTranslation( layerToWord );
+
+    switch ( ring.ndims() ) {
+    case 2:
+        transformPoints< 2 >( layerToWord, translation, in, count, false, out );
+        break;
+    case 3:
+        transformPoints< 3 >( layerToWord, translation, in, count, ring.hasZ(), out );
+        break;
+    case 4:
+        transformPoints< 4 >( layerToWord, translation, in, count, ring.hasZ(), out );
+        break;
+    default:
+        throw std::runtime_error( "unexpected number of dimensions" );
+    }
+}
+
 // for debugging
 inline
 std::ostream& operator<<( std::ostream& o, const osg::Vec3& v )
@@ -109,8 +533,6 @@ std::ostream& operator<<( std::ostream& o, const osg::Vec3& v )
 }
 
 
-#ifdef POLY2TRI
-
 struct Validity {
     /**
      * @note the class has private ctor to force the use of functions valid() and invalid(reason) that are clearer in the code than to remember that "Valid constructed with a reason is invalid"
@@ -164,17 +586,23 @@ struct Ring2d : std::vector< osg::Vec2 > {};
 //! and prunes dupplicate points and remove last point
 //! we keep the last point wich should be a duplicate of the first
 struct Poly : boost::noncopyable {
-    Poly( const LWPOLY* lwpoly, const osg::Matrix& layerToWord  )
-        : rings( lwpoly->nrings ) {
+    template< typename POLYGON >
+    Poly( const POLYGON& polygon, const osg::Matrix& layerToWord  )
+        : rings( polygon.numRings() ) {
         const size_t nrings = rings.size();
 
+        std::vector< double > buffer;
+        std::vector< osg::Vec3 > points;
+
         for ( size_t r=0; r<nrings; r++ ) {
-            const size_t npoints = lwpoly->rings[r]->npoints;
+            const typename POLYGON::Ring ring( polygon.ring( r ) );
+            const size_t npoints = ring.size();
             rings[r].reserve( npoints );
+            points.resize( npoints );
+            transformRing( ring, npoints, layerToWord, buffer, points.empty() ? NULL : points[0].ptr() );
 
             for ( size_t p=0; p<npoints; p++ ) {
-                const POINT3DZ p3D = getPoint3dz( lwpoly->rings[r], p );
-                const osg::Vec3 point =  osg::Vec3( p3D.x, p3D.y, p3D.z ) * layerToWord;
+                const osg::Vec3& point = points[p];
 
                 if ( !p || rings[r].back() != point ) {
                     rings[r].push_back( point );
@@ -379,78 +807,203 @@ private:
     std::vector< osg::Vec2 > _points;
 };
 
+//! bounding box of the segment [ring[index], ring[index+1]] of ring number ringIndex
+struct SegmentBox {
+    SegmentBox( const osg::Vec2& s, const osg::Vec2& e, size_t r, size_t i )
+        : ring( r )
+        , index( i ) {
+        // padded, the intersection test is tolerant
+        const float pad = 4 * FLT_EPSILON * ( 1 + std::max( std::max( std::abs( s.x() ), std::abs( s.y() ) ),
+                                                          std::max( std::abs( e.x() ), std::abs( e.y() ) ) ) );
+        xmin = std::min( s.x(), e.x() ) - pad;
+        xmax = std::max( s.x(), e.x() ) + pad;
+        ymin = std::min( s.y(), e.y() ) - pad;
+        ymax = std::max( s.y(), e.y() ) + pad;
+    }
+
+    bool operator<( const SegmentBox& other ) const {
+        return xmin < other.xmin;
+    }
+
+    bool overlaps( const SegmentBox& other ) const {
+        return xmin <= other.xmax && other.xmin <= xmax && ymin <= other.ymax && other.ymin <= ymax;
+    }
+
+    void expandBy( const SegmentBox& other ) {
+        xmin = std::min( xmin, other.xmin );
+        xmax = std::max( xmax, other.xmax );
+        ymin = std::min( ymin, other.ymin );
+        ymax = std::max( ymax, other.ymax );
+    }
+
+    float xmin, xmax, ymin, ymax;
+    size_t ring;
+    size_t index;
+};
+
 inline
-bool selfIntersects( const Ring2d& ring )
+void appendSegmentBoxes( const Ring2d& ring, size_t ringIndex, std::vector< SegmentBox >& boxes )
 {
-    // stupid O( n² ) algo
     const size_t npoints = ring.size() - 1;
-    const size_t npointsMinus = npoints - 1;
 
-    for ( size_t i=0; i<npointsMinus; i++ ) {
-        const Segment2d s1( ring[i], ring[i+1] );
+    for ( size_t i=0; i<npoints; i++ ) {
+        boxes.push_back( SegmentBox( ring[i], ring[i+1], ringIndex, i ) );
+    }
+}
+
+//! sweep and prune: the boxes are sorted along x, and each one is only compared to the
+//! following ones that start before its end, so this is O( n log n ) for the usual
+//! rings instead of O( n² ), pairs with overlapping boxes are given to the visitor
+//! @param visitor returns false to stop the sweep
+//! @return false if the sweep was stopped
+template< typename VISITOR >
+bool sweep( std::vector< SegmentBox >& boxes, VISITOR& visitor )
+{
+    std::sort( boxes.begin(), boxes.end() );
+    const size_t nboxes = boxes.size();
+
+    for ( size_t k=0; k<nboxes; k++ ) {
+        const SegmentBox& a = boxes[k];
 
-        for ( size_t j=i+2; j<npoints; j++ ) { // do not test neighbors
-            const Segment2d s2( ring[j], ring[j+1] );
-            const Intersection inter( s1, s2 );
+        for ( size_t l=k+1; l<nboxes && boxes[l].xmin <= a.xmax; l++ ) {
+            const SegmentBox& b = boxes[l];
 
-            if ( inter.dimension() > 0  && !( inter.dimension() == 1 && 0 == i && ( npoints - 1 ) == j ) ) {
-                return true;
+            if ( a.overlaps( b ) && !visitor( a, b ) ) {
+                return false;
             }
         }
     }
 
-    return false;
+    return true;
 }
 
-const size_t INF = size_t( -1 );
-//! @return the number of point itersections, INF if line intersection
+//! stops the sweep at the first intersection between segments that are not neighbors
+struct SelfIntersectionVisitor {
+    SelfIntersectionVisitor( const Ring2d& ring ): _ring( ring ) {}
+
+    bool operator()( const SegmentBox& a, const SegmentBox& b ) const {
+        const size_t i = std::min( a.index, b.index );
+        const size_t j = std::max( a.index, b.index );
+
+        if ( j == i+1 ) { // do not test neighbors
+            return true;
+        }
+
+        const Segment2d s1( _ring[i], _ring[i+1] );
+        const Segment2d s2( _ring[j], _ring[j+1] );
+        const Intersection inter( s1, s2 );
+
+        // first and last segments are neighbors too
+        return !( inter.dimension() > 0  && !( inter.dimension() == 1 && 0 == i && ( _ring.size() - 2 ) == j ) );
+    }
+private:
+    const Ring2d& _ring;
+};
+
 inline
-size_t nbIntersections( const Ring2d& ring1, const Ring2d& ring2 )
+bool selfIntersects( const Ring2d& ring )
 {
+    std::vector< SegmentBox > boxes;
+    boxes.reserve( ring.size() );
+    appendSegmentBoxes( ring, 0, boxes );
+    SelfIntersectionVisitor visitor( ring );
+    return !sweep( boxes, visitor );
+}
+
+// insert only points that are far enought from already inserted ones
+// points are hashed on a grid of the size of the tolerance, so only
+// the points of the neighboring cells are compared
+struct UniquePointSet: boost::noncopyable {
+    UniquePointSet(): _cellSize( std::sqrt( FLT_EPSILON ) ), _size( 0 ) {}
 
-    // insert only points that are far enought from already inserted ones
-    struct UniquePointSet: boost::noncopyable {
-        void insert( const osg::Vec2& p ) {
-            for ( size_t i=0; i<_points.size(); i++ ) {
-                if ( ( _points[i] - p ).length2() < FLT_EPSILON ) {
-                    return;
+    void insert( const osg::Vec2& p ) {
+        const long long cx = std::floor( p.x() / _cellSize );
+        const long long cy = std::floor( p.y() / _cellSize );
+
+        for ( long long x = cx-1; x <= cx+1; x++ ) {
+            for ( long long y = cy-1; y <= cy+1; y++ ) {
+                const Cells::const_iterator cell = _cells.find( key( x, y ) );
+
+                if ( cell == _cells.end() ) {
+                    continue;
                 }
-            }
 
-            _points.push_back( p );
+                for ( size_t i=0; i<cell->second.size(); i++ ) {
+                    if ( ( cell->second[i] - p ).length2() < FLT_EPSILON ) {
+                        return;
+                    }
+                }
+            }
         }
 
-        size_t size() const {
-            return _points.size();
-        }
-    private:
-        std::vector<osg::Vec2> _points;
-    };
+        _cells[ key( cx, cy ) ].push_back( p );
+        ++_size;
+    }
 
-    UniquePointSet set;
+    size_t size() const {
+        return _size;
+    }
+private:
+    typedef std::unordered_map< long long, std::vector< osg::Vec2 > > Cells;
+    Cells _cells;
+    const float _cellSize;
+    size_t _size;
 
-    // stupid O( n x m ) algo
-    const size_t npoints1 = ring1.size() - 1;
-    const size_t npoints2 = ring2.size() - 1;
+    static long long key( long long x, long long y ) {
+        return x * 0x9E3779B1LL + y;
+    }
+};
 
-    for ( size_t i=0; i<npoints1; i++ ) {
-        const Segment2d s1( ring1[i], ring1[i+1] );
+const size_t INF = size_t( -1 );
 
-        for ( size_t j=0; j<npoints2; j++ ) {
-            const Segment2d s2( ring2[j], ring2[j+1] );
-            const Intersection inter( s1, s2 );
+//! collects the contact points between segments of two different rings
+//! stops the sweep if they share a segment
+struct RingIntersectionVisitor {
+    RingIntersectionVisitor( const Ring2d& ring1, const Ring2d& ring2 )
+        : _ring1( ring1 ), _ring2( ring2 ), lineIntersection( false ) {}
 
-            if ( inter.dimension() == 1 ) {
-                set.insert( inter.point() );
-            }
-            else if ( inter.dimension() == 2 ) {
-                return INF;
-            }
+    bool operator()( const SegmentBox& a, const SegmentBox& b ) {
+        if ( a.ring == b.ring ) {
+            return true;
+        }
+
+        const SegmentBox& b1 = a.ring ? b : a;
+        const SegmentBox& b2 = a.ring ? a : b;
+        const Segment2d s1( _ring1[b1.index], _ring1[b1.index+1] );
+        const Segment2d s2( _ring2[b2.index], _ring2[b2.index+1] );
+        const Intersection inter( s1, s2 );
+
+        if ( inter.dimension() == 1 ) {
+            points.insert( inter.point() );
         }
+        else if ( inter.dimension() == 2 ) {
+            lineIntersection = true;
+            return false;
+        }
+
+        return true;
     }
+private:
+    const Ring2d& _ring1;
+    const Ring2d& _ring2;
+public:
+    UniquePointSet points;
+    bool lineIntersection;
+};
 
-    //if (set.size() == 1) DEBUG_TRACE << "one contact point between two rings\n";
-    return set.size();
+//! @return the number of point itersections, INF if line intersection
+inline
+size_t nbIntersections( const Ring2d& ring1, const Ring2d& ring2 )
+{
+    std::vector< SegmentBox > boxes;
+    boxes.reserve( ring1.size() + ring2.size() );
+    appendSegmentBoxes( ring1, 0, boxes );
+    appendSegmentBoxes( ring2, 1, boxes );
+    RingIntersectionVisitor visitor( ring1, ring2 );
+    sweep( boxes, visitor );
+
+    //if (visitor.points.size() == 1) DEBUG_TRACE << "one contact point between two rings\n";
+    return visitor.lineIntersection ? INF : visitor.points.size();
 }
 
 // you get usefull output from this
@@ -532,8 +1085,24 @@ const Validity isValid( const Poly& poly, osg::Vec3 base[3], std::unique_ptr<Pol
             typedef std::pair<int,int> Edge;
             std::vector<Edge> touchingRings;
 
+            // rings that are far apart are not tested
+            std::vector< SegmentBox > ringBoxes;
+
+            for ( size_t r=0; r < nrings; ++r ) {
+                const Ring2d& ring = poly2d->rings[r];
+                ringBoxes.push_back( SegmentBox( ring[0], ring[1], r, 0 ) );
+
+                for ( size_t i=1; i+1 < ring.size(); ++i ) {
+                    ringBoxes.back().expandBy( SegmentBox( ring[i], ring[i+1], r, i ) );
+                }
+            }
+
             for ( size_t ri=0; ri < nrings; ++ri ) { // no need for numRings-1, the next loop won't be entered for the last ring
                 for ( size_t rj=ri+1; rj < nrings; ++rj ) {
+                    if ( !ringBoxes[ri].overlaps( ringBoxes[rj] ) ) {
+                        continue;
+                    }
+
                     const size_t nbInter = nbIntersections( poly2d->rings[ri], poly2d->rings[rj] );
 
                     if ( nbInter > 1 ) {
@@ -587,69 +1156,295 @@ const Validity isValid( const Poly& poly, osg::Vec3 base[3], std::unique_ptr<Pol
     return Validity::valid();
 }
 
-void Mesh::push_back( const LWPOLY* lwpoly )
+// nop callback
+void CALLBACK noStripCB( GLboolean flag )
 {
-    assert( lwpoly );
-    assert( lwpoly->nrings > 0 );
-
-    Poly poly( lwpoly, _layerToWord );
-    osg::Vec3 base[3];
-    std::unique_ptr< Poly2d > poly2d;
-    Validity validity( isValid( poly, base, poly2d ) );
+    //assert( flag );
+    ( void )flag;
+}
 
-    if ( !validity ) {
-        //! todo draw lines for rings but no contour
-        //wkt = lwgeom_to_wkt(lwpoly_as_lwgeom(lwpoly), WKT_EXTENDED, 16, NULL);
-        //ERROR << "invalid polygon (" << validity.reason() << ") :" << wkt << "\n";
-        //free(wkt);
-        throw std::runtime_error( "invalid polygon (" + validity.reason() + ")" );
-    }
+void CALLBACK tessBeginCB( GLenum which )
+{
+    //assert( which == GL_TRIANGLES );
+    ( void )which;
+}
 
-    const osg::Vec3 normal = base[2];
+void CALLBACK tessEndCB( GLenum which )
+{
+    //assert( which == GL_TRIANGLES );
+    ( void )which;
+}
 
-    const float distance = normal * poly.rings[0][0];
+void CALLBACK tessErrorCB( GLenum errorCode )
+{
+    const GLubyte* errorStr = gluErrorString( errorCode );
+    throw std::runtime_error( reinterpret_cast<const char*>( errorStr ) );
+}
 
-    std::unique_ptr<p2t::CDT> cdt;
+void CALLBACK tessVertexCB( const GLdouble* vtx, void* data )
+{
+    // cast back to double type
+    Mesh* that = ( Mesh* )data;
+    that->_tri.push_back( that->_vtx.size() );
+    that->_vtx.push_back( osg::Vec3( vtx[0], vtx[1], vtx[2] ) );
+}
 
-    const float dmax = 100.f;
+struct VecGL {
+    GLdouble _comp[3];
+};
+
+void CALLBACK tessCombineCB( GLdouble coords[3], GLdouble* vertexData[4], GLfloat weight[4], void** outData, void* data );
+
+// for RAII off GLUtesselator, and storage of the tessellated polygon coordinates
+// one per mesh, reused for all its polygons, for both triangulators
+struct Tessellator {
+    Tessellator() {
+        _tess = gluNewTess();
+        gluTessProperty( _tess, GLU_TESS_WINDING_RULE, GLU_TESS_WINDING_POSITIVE );
+        //gluTessProperty(_tess, GLU_TESS_BOUNDARY_ONLY, GL_TRUE);
+        gluTessCallback( _tess, GLU_TESS_BEGIN, ( void (* )( void ) )tessBeginCB );
+        gluTessCallback( _tess, GLU_TESS_END, ( void (* )( void ) )tessEndCB );
+        gluTessCallback( _tess, GLU_TESS_ERROR, ( void (* )( void ) )tessErrorCB );
+        gluTessCallback( _tess, GLU_TESS_VERTEX_DATA, ( void (* )() )tessVertexCB );
+        gluTessCallback( _tess, GLU_TESS_EDGE_FLAG,  ( void (* )() )noStripCB );
+        gluTessCallback( _tess, GLU_TESS_COMBINE_DATA,  ( void (* )() )tessCombineCB );
+    }
+    ~Tessellator() {
+        gluDeleteTess( _tess );
+    }
+
+    GLUtesselator* _tess;
+    std::vector< GLdouble > _coord; // polygon vertices, capacity is kept between polygons
+    std::deque< VecGL > _combined;  // vertices created by the tessellator, adresses must be stable
+
+    // poly2tri: the points are stored by value and the triangulation structures live in an arena
+    p2t::Arena _arena;
+    std::vector< p2t::Point > _points;
+    std::vector< size_t > _ringEnds; // end of each ring in _points
+    std::vector< p2t::Point* > _polyline;
+    std::vector< size_t > _order;    // points sorted by coordinates
+
+    //! the previous triangulation must have been destroyed
+    void resetCdt() {
+        _points.clear(); // before the arena, since points refer to edges
+        _ringEnds.clear();
+        _arena.Reset();
+    }
+};
+
+void CALLBACK tessCombineCB( GLdouble coords[3], GLdouble* /*vertexData*/[4], GLfloat /*weight*/[4], void** outData, void* data )
+{
+    Mesh* that = ( Mesh* )data;
+    std::deque< VecGL >& combined = that->_tessellator->_combined;
+    combined.push_back( VecGL() );
+    GLdouble* vertex = combined.back()._comp;
+    vertex[0] = coords[0];
+    vertex[1] = coords[1];
+    vertex[2] = coords[2];
+    *outData = vertex;
+}
+
+//! @return true if the ring (without closing point) is convex and turns
+//!         around normal, star shaped rings (turning more than once) are not
+inline
+bool isConvex( const std::vector< osg::Vec3 >& ring, const osg::Vec3& normal )
+{
+    const size_t n = ring.size();
+
+    if ( n < 3 || normal.length2() < FLT_EPSILON ) {
+        return false;
+    }
+
+    // project on the axis plane where the polygon is the largest
+    // the projected cross product is then the component 'drop' of the 3D one
+    const osg::Vec3 a( std::abs( normal.x() ), std::abs( normal.y() ), std::abs( normal.z() ) );
+    const int drop = a.x() > a.y() ? ( a.x() > a.z() ? 0 : 2 ) : ( a.y() > a.z() ? 1 : 2 );
+    const int u = ( drop + 1 ) % 3;
+    const int v = ( drop + 2 ) % 3;
+    const float orientation = normal[drop] > 0 ? 1.f : -1.f;
+
+    // a convex ring changes direction along u twice
+    int directionChanges = 0;
+    float firstDu = 0;
+    float prevDu = 0;
+
+    for ( size_t i = 0; i < n; i++ ) {
+        const osg::Vec3& p0 = ring[i];
+        const osg::Vec3& p1 = ring[( i+1 ) % n];
+        const osg::Vec3& p2 = ring[( i+2 ) % n];
+        const float cross = ( p1[u] - p0[u] ) * ( p2[v] - p1[v] ) - ( p1[v] - p0[v] ) * ( p2[u] - p1[u] );
+
+        if ( cross * orientation < 0 ) {
+            return false;
+        }
+
+        const float du = p1[u] - p0[u];
+
+        if ( du != 0 ) {
+            if ( prevDu != 0 && ( du > 0 ) != ( prevDu > 0 ) ) {
+                ++directionChanges;
+            }
+
+            if ( firstDu == 0 ) {
+                firstDu = du;
+            }
+
+            prevDu = du;
+        }
+    }
+
+    if ( ( firstDu > 0 ) != ( prevDu > 0 ) ) {
+        ++directionChanges;
+    }
+
+    return directionChanges <= 2;
+}
+
+//! order of points by coordinates, then by index
+struct PointOrder {
+    PointOrder( const std::vector< p2t::Point >& points ): _points( points ) {}
+    bool operator()( size_t a, size_t b ) const {
+        const p2t::Point& pa = _points[a];
+        const p2t::Point& pb = _points[b];
+        return pa.x < pb.x || ( pa.x == pb.x && ( pa.y < pb.y || ( pa.y == pb.y && a < b ) ) );
+    }
+private:
+    const std::vector< p2t::Point >& _points;
+};
+
+//! poly2tri fails on rings touching at a vertex, so every repetition of a vertex
+//! is moved slightly inside its own ring (into the polygon for the exterior ring,
+//! into the hole for interior rings), wich splits the rings apart
+//! @param ringEnds end of each ring in points, the exterior ring is counterclockwise
+inline
+void separateTouchingVertices( std::vector< p2t::Point >& points, const std::vector< size_t >& ringEnds, std::vector< size_t >& order )
+{
+    order.resize( points.size() );
+
+    for ( size_t i=0; i<order.size(); i++ ) {
+        order[i] = i;
+    }
+
+    std::sort( order.begin(), order.end(), PointOrder( points ) );
+
+    double x = 0, y = 0; // first occurence of the current point, wich is not moved
+
+    for ( size_t k=0; k<order.size(); k++ ) {
+        const size_t i = order[k];
+        p2t::Point& p = points[i];
+
+        if ( !k || p.x != x || p.y != y ) {
+            x = p.x;
+            y = p.y;
+            continue;
+        }
+
+        const size_t r = std::upper_bound( ringEnds.begin(), ringEnds.end(), i ) - ringEnds.begin();
+        const size_t begin = r ? ringEnds[r-1] : 0;
+        const size_t n = ringEnds[r] - begin;
+        const p2t::Point& prev = points[ begin + ( i - begin + n - 1 ) % n ];
+        const p2t::Point& next = points[ begin + ( i - begin + 1 ) % n ];
+
+        const osg::Vec2d in( p.x - prev.x, p.y - prev.y );
+        const osg::Vec2d out( next.x - p.x, next.y - p.y );
+        const double inLength = in.length();
+        const double outLength = out.length();
+
+        if ( inLength == 0 || outLength == 0 ) {
+            continue;
+        }
+
+        // bisector of the corner, on the left of a counterclockwise ring
+        osg::Vec2d direction( -in.y()/inLength - out.y()/outLength, in.x()/inLength + out.x()/outLength );
+
+        if ( direction.length2() < 1e-12 ) { // spike
+            direction.set( -in.y(), in.x() );
+        }
+
+        direction.normalize();
+        const double shift = ( r ? -1e-3 : 1e-3 ) * std::min( inLength, outLength );
+        p.x += shift * direction.x();
+        p.y += shift * direction.y();
+    }
+}
+
+template< typename POLYGON >
+void Mesh::addPolygonCdt( const POLYGON& polygon )
+{
+    Poly poly( polygon, _layerToWord );
+    osg::Vec3 base[3];
+    std::unique_ptr< Poly2d > poly2d;
+    Validity validity( isValid( poly, base, poly2d, _fullCheck ) );
+
+    if ( !validity ) {
+        throw std::runtime_error( "invalid polygon (" + validity.reason() + ")" );
+    }
+
+    const float distance = base[2] * poly.rings[0][0];
+
+    if ( !_tessellator.get() ) {
+        _tessellator.reset( new Tessellator );
+    }
+
+    Tessellator& tessellator = *_tessellator;
+    tessellator.resetCdt();
+    std::vector< p2t::Point >& points = tessellator._points;
+
+    const float dmax = 100.f;
 
     const float dmax2 = dmax*dmax;
 
-    try {
-        // retesselate
-        const size_t nrings = poly2d->rings.size();
+    // points are created first, poly2tri keeps pointers to them
+    const size_t nrings = poly2d->rings.size();
 
-        for ( size_t r = 0; r < nrings; r++ ) {
-            const int npoints = poly2d->rings[r].size() - 1;
-            std::vector<p2t::Point*> polyline;
-            polyline.reserve( npoints*1.3f );
-            osg::Vec2 prev( 0,0 );
+    for ( size_t r = 0; r < nrings; r++ ) {
+        const int npoints = poly2d->rings[r].size() - 1;
+        osg::Vec2 prev( 0,0 );
 
-            for( int v = 0; v < npoints; v++ ) {
-                const osg::Vec2 p =  poly2d->rings[r][v];
-                const osg::Vec2 delta = p - prev;
-                const float delta2 = delta.length2();
+        for( int v = 0; v < npoints; v++ ) {
+            const osg::Vec2 p =  poly2d->rings[r][v];
+            const osg::Vec2 delta = p - prev;
+            const float delta2 = delta.length2();
 
-                if ( v && delta2 < 2*FLT_MIN ) {
-                    continue;
-                }
+            if ( v && delta2 < 2*FLT_MIN ) {
+                continue;
+            }
 
-                if ( v && delta2 > dmax2 ) {
-                    // interpolate points
-                    const size_t nbAddedPt = std::sqrt( delta2 )/ dmax;
+            if ( v && delta2 > dmax2 ) {
+                // interpolate points
+                const size_t nbAddedPt = std::sqrt( delta2 )/ dmax;
 
-                    for ( size_t i=1; i<nbAddedPt; i++ ) {
-                        const osg::Vec2 addedP = prev + delta*float( i )/nbAddedPt;
-                        polyline.push_back( new p2t::Point( addedP.x(), addedP.y() ) );
-                    }
+                for ( size_t i=1; i<nbAddedPt; i++ ) {
+                    const osg::Vec2 addedP = prev + delta*float( i )/nbAddedPt;
+                    points.push_back( p2t::Point( addedP.x(), addedP.y() ) );
                 }
+            }
+
+            points.push_back( p2t::Point( p.x(), p.y() ) );
+            prev = p;
+        }
+
+        tessellator._ringEnds.push_back( points.size() );
+    }
+
+    separateTouchingVertices( points, tessellator._ringEnds, tessellator._order );
+
+    // the cdt uses the arena, it must be destroyed before the next reset
+    std::unique_ptr<p2t::CDT> cdt;
+
+    try {
+        // retesselate
+        std::vector< p2t::Point* >& polyline = tessellator._polyline;
+
+        for ( size_t r = 0; r < nrings; r++ ) {
+            polyline.clear();
 
-                polyline.push_back( new p2t::Point( p.x(), p.y() ) );
-                prev = p;
+            for ( size_t i = r ? tessellator._ringEnds[r-1] : 0; i < tessellator._ringEnds[r]; i++ ) {
+                polyline.push_back( &points[i] );
             }
 
             if ( !r ) {
-                cdt.reset( new p2t::CDT( polyline ) );
+                cdt.reset( new p2t::CDT( polyline, tessellator._arena ) );
             }
             else {
                 cdt->AddHole( polyline );
@@ -662,147 +1457,92 @@ void Mesh::push_back( const LWPOLY* lwpoly )
         throw std::runtime_error( std::string( "from poly2tri: " ) + e.what() );
     }
 
+    // vertices are shared by triangles, the index of a point is its position in points
+    const size_t vtxSize = _vtx.size();
+
+    for ( size_t i = 0; i < points.size(); i++ ) {
+        _vtx.push_back( base[0] * points[i].x + base[1] * points[i].y + base[2] * distance );
+    }
+
     std::vector<p2t::Triangle*> triangles( cdt->GetTriangles() );
 
     for ( size_t i = 0; i < triangles.size(); i++ ) {
         p2t::Triangle& t = *triangles[i];
 
         for ( int j=0; j<3; j++ ) {
-            p2t::Point& a = *t.GetPoint( j );
-            _tri.push_back( _vtx.size() );
-            _vtx.push_back( base[0] * a.x + base[1] * a.y + base[2] * distance );
-        }
-    }
+            const size_t index = t.GetPoint( j ) - &points[0];
 
-    _nrml.resize( _vtx.size(), normal );
-}
+            if ( index >= points.size() ) {
+                throw std::runtime_error( "from poly2tri: triangle with a point not in the polygon" );
+            }
 
-#else
-// nop callback
-void CALLBACK noStripCB( GLboolean flag )
-{
-    //assert( flag );
-    ( void )flag;
+            _tri.push_back( vtxSize + index );
+        }
+    }
 }
 
-void CALLBACK tessBeginCB( GLenum which )
+template< typename POLYGON >
+void Mesh::addPolygonGlu( const POLYGON& polygon )
 {
-    //assert( which == GL_TRIANGLES );
-    ( void )which;
-}
+    const int numRings = polygon.numRings();
+    size_t totalNumVtx = 0;
 
-void CALLBACK tessEndCB( GLenum which )
-{
-    //assert( which == GL_TRIANGLES );
-    ( void )which;
-}
+    for ( int r = 0; r < numRings; r++ ) {
+        totalNumVtx += polygon.ring( r ).size();
+    }
 
-void CALLBACK tessErrorCB( GLenum errorCode )
-{
-    const GLubyte* errorStr = gluErrorString( errorCode );
-    throw std::runtime_error( reinterpret_cast<const char*>( errorStr ) );
-}
+    if ( !_tessellator.get() ) {
+        _tessellator.reset( new Tessellator );
+    }
 
-void CALLBACK tessVertexCB( const GLdouble* vtx, void* data )
-{
-    // cast back to double type
-    Mesh* that = ( Mesh* )data;
-    that->_tri.push_back( that->_vtx.size() );
-    that->_vtx.push_back( osg::Vec3( vtx[0], vtx[1], vtx[2] ) );
-}
+    Tessellator& tesselator = *_tessellator;
 
-struct VecGL {
-    GLdouble _comp[3];
-};
-std::list< VecGL > globalVtxForGlu;
+    // glu keeps pointers to the coordinates until the end of the polygon, so
+    // the buffer is sized before, and not resized during tessellation
+    std::vector< GLdouble >& coord = tesselator._coord;
+    coord.resize( totalNumVtx*3 );
 
-void CALLBACK tessCombineCB( GLdouble coords[3], GLdouble* /*vertex_data*/[4], GLfloat /*weight*/[4], void** outData, void* /*data*/ )
-{
+    // retesselate and add rings
+    gluTessBeginPolygon( tesselator._tess, this );
+    size_t currIdx = 0;
 
-    globalVtxForGlu.push_back( VecGL() );
-    GLdouble* vertex = globalVtxForGlu.back()._comp;
-    vertex[0] = coords[0];
-    vertex[1] = coords[1];
-    vertex[2] = coords[2];
-    *outData = vertex;
-}
+    for ( int r = 0; r < numRings; r++ ) {
+        gluTessBeginContour( tesselator._tess );                    // outer quad
+        const typename POLYGON::Ring ring( polygon.ring( r ) );
+        const int ringSize = ring.size();
+        transformRing( ring, ringSize - 1, _layerToWord, _coordinates, &( coord[currIdx] ) );
+
+        for( int v = 0; v < ringSize - 1; v++ ) {
+            gluTessVertex( tesselator._tess, &( coord[currIdx] ), &( coord[currIdx] ) );
+            currIdx+=3;
+        }
 
-// for RAII off GLUtesselator
-struct Tessellator {
-    Tessellator() {
-        _tess = gluNewTess();
-        gluTessProperty( _tess, GLU_TESS_WINDING_RULE, GLU_TESS_WINDING_POSITIVE );
-        //gluTessProperty(_tess, GLU_TESS_BOUNDARY_ONLY, GL_TRUE);
-        gluTessCallback( _tess, GLU_TESS_BEGIN, ( void (* )( void ) )tessBeginCB );
-        gluTessCallback( _tess, GLU_TESS_END, ( void (* )( void ) )tessEndCB );
-        gluTessCallback( _tess, GLU_TESS_ERROR, ( void (* )( void ) )tessErrorCB );
-        gluTessCallback( _tess, GLU_TESS_VERTEX_DATA, ( void (* )() )tessVertexCB );
-        gluTessCallback( _tess, GLU_TESS_EDGE_FLAG,  ( void (* )() )noStripCB );
-        gluTessCallback( _tess, GLU_TESS_COMBINE_DATA,  ( void (* )() )tessCombineCB );
-    }
-    ~Tessellator() {
-        gluDeleteTess( _tess );
+        gluTessEndContour( tesselator._tess );                    // outer quad
     }
 
-    GLUtesselator* _tess;
-};
+    gluTessEndPolygon( tesselator._tess );
+    tesselator._combined.clear();
+}
 
-template<>
-void Mesh::push_back( const LWPOLY* lwpoly )
+template< typename POLYGON >
+void Mesh::addPolygon( const POLYGON& polygon )
 {
-    assert( lwpoly );
-
-    const int numRings = lwpoly->nrings;
+    const int numRings = polygon.numRings();
 
     if ( numRings == 0 ) {
         return;
     }
 
-    size_t totalNumVtx = 0;
-
-    for ( int r = 0; r < numRings; r++ ) {
-        totalNumVtx += lwpoly->rings[r]->npoints;
-    }
-
-    std::vector< GLdouble > coord( totalNumVtx*3 );
-
-    const size_t size = _tri.size();
-    assert( _vtx.size() == size );
-
-    try {
-        // retesselate and add rings
-        Tessellator tesselator ;
-        gluTessBeginPolygon( tesselator._tess, this ); // with NULL data
-        size_t currIdx = 0;
-
-        for ( int r = 0; r < numRings; r++ ) {
-            gluTessBeginContour( tesselator._tess );                    // outer quad
-            const int ringSize = lwpoly->rings[r]->npoints;
-
-            for( int v = 0; v < ringSize - 1; v++ ) {
-                const POINT3DZ p3D = getPoint3dz( lwpoly->rings[r], v );
-                const osg::Vec3 p = osg::Vec3( p3D.x, p3D.y, p3D.z ) * _layerToWord;
-                coord[currIdx + 0] = p.x();
-                coord[currIdx + 1] = p.y();
-                coord[currIdx + 2] = p.z();
-                gluTessVertex( tesselator._tess, &( coord[currIdx] ), &( coord[currIdx] ) );
-                currIdx+=3;
-            }
-
-            gluTessEndContour( tesselator._tess );                    // outer quad
-        }
+    // exterior ring, without closing point
+    const typename POLYGON::Ring exterior( polygon.ring( 0 ) );
+    const int sz = exterior.size() - 1;
 
-        gluTessEndPolygon( tesselator._tess );
-        globalVtxForGlu.clear(); // should keep allocated (reserved memory)
-    }
-    catch ( std::exception& e ) {
-        std::cerr << "warnig: cannot tesselate polygon: " << e.what() << "\n";
-        // undo modifications to _tri and _vtx
-        _tri.resize( size );
-        _vtx.resize( size );
-        globalVtxForGlu.clear(); // should keep allocated (reserved memory)
+    if ( sz < 3 ) {
+        return;
     }
 
+    _ring.resize( sz );
+    transformRing( exterior, sz, _layerToWord, _coordinates, _ring[0].ptr() );
 
     //// Normal computation.
     ////
@@ -811,185 +1551,283 @@ void Mesh::push_back( const LWPOLY* lwpoly )
     //// In this case, we would have to average the normal vector over each triangle of the polygon.
     //// The Newell's formula is simpler and more direct here.
     osg::Vec3 normal( 0.0, 0.0, 0.0 );
-    const int sz = lwpoly->rings[0]->npoints;
 
-    for ( int i = 0; i < sz; ++i ) {
-        const POINT3DZ p3Di = getPoint3dz( lwpoly->rings[0], i );
-        const POINT3DZ p3Dj = getPoint3dz( lwpoly->rings[0], ( i+1 ) % sz );
-        const osg::Vec3 pi= osg::Vec3( p3Di.x, p3Di.y, p3Di.z ) * _layerToWord;
-        const osg::Vec3 pj= osg::Vec3( p3Dj.x, p3Dj.y, p3Dj.z ) * _layerToWord;
-        normal[0] += ( pi[1] - pj[1] ) * ( pi[2] + pj[2] );
-        normal[1] += ( pi[2] - pj[2] ) * ( pi[0] + pj[0] );
-        normal[2] += ( pi[0] - pj[0] ) * ( pi[1] + pj[1] );
-    }
-
-    normal.normalize();
-
-    if ( ( FLAGS_GET_Z( lwpoly->flags ) == 0 ) && ( normal[2] < 0 ) ) {
-        // if this is a 2D surface and the normal is pointing down, reverse each new triangle
-        normal[2] = 1;
-
-        for ( size_t i = size/3; i < _tri.size() / 3; ++i ) {
-            std::swap( _tri[3*i], _tri[3*i+2] );
+    {
+        ScopedTiming timing( _timed, _timings.normals );
+
+        for ( int i = 0; i < sz; ++i ) {
+            const osg::Vec3& pi = _ring[i];
+            const osg::Vec3& pj = _ring[( i+1 ) % sz];
+            normal[0] += ( pi[1] - pj[1] ) * ( pi[2] + pj[2] );
+            normal[1] += ( pi[2] - pj[2] ) * ( pi[0] + pj[0] );
+            normal[2] += ( pi[0] - pj[0] ) * ( pi[1] + pj[1] );
         }
+
+        normal.normalize();
     }
 
-    _nrml.resize( _vtx.size(), normal );
+    const size_t size = _tri.size();
+    const size_t vtxSize = _vtx.size();
 
-}
-#endif
+    ScopedTiming tessellation( _timed, _timings.tessellation );
 
+    if ( numRings == 1 && isConvex( _ring, normal ) ) {
+        // fan, vertices are shared by triangles
+        _vtx.insert( _vtx.end(), _ring.begin(), _ring.end() );
 
+        for ( int i = 1; i < sz - 1; ++i ) {
+            _tri.push_back( vtxSize );
+            _tri.push_back( vtxSize + i );
+            _tri.push_back( vtxSize + i + 1 );
+        }
 
-// we create the box triangles ourselves since an osg::Box for each feature is really slow
-void Mesh::addBar( WKB center, float width, float depth, float height )
-{
+        ++_stats.fan;
+    }
+    else {
+        bool triangulated = false;
+
+        if ( _triangulator == CDT ) {
+            try {
+                addPolygonCdt( polygon );
+                triangulated = true;
+                ++_stats.cdt;
+            }
+            catch ( std::exception& ) {
+                // poly2tri is not robust, GLU gets a chance
+                _tri.resize( size );
+                _vtx.resize( vtxSize );
+                ++_stats.fallback;
+            }
+        }
 
-    Lwgeom lwgeom( center );
+        if ( !triangulated ) {
+            try {
+                addPolygonGlu( polygon );
+            }
+            catch ( std::exception& e ) {
+                std::cerr << "warnig: cannot tesselate polygon: " << e.what() << "\n";
+                // undo modifications to _tri and _vtx
+                _tri.resize( size );
+                _vtx.resize( vtxSize );
+                // the tessellator is left in the middle of a polygon, start with a new one
+                _tessellator.reset();
+            }
 
-    if ( !lwgeom.get() ) {
-        return;    // the error reporter takes care of errors
+            ++_stats.glu;
+        }
     }
 
-    LWPOINT* lwpoint = lwgeom_as_lwpoint( lwgeom.get() );
+    tessellation.stop();
 
-    if( !lwpoint ) {
-        throw std::runtime_error( "failed to get points from WKB" );
+    if ( !polygon.hasZ() && ( normal[2] < 0 ) ) {
+        // if this is a 2D surface and the normal is pointing down, reverse each new triangle
+        normal[2] = 1;
+
+        for ( size_t i = size/3; i < _tri.size() / 3; ++i ) {
+            std::swap( _tri[3*i], _tri[3*i+2] );
+        }
     }
 
-    const POINT3DZ p = getPoint3dz( lwpoint->point, 0 );
+    _nrml.resize( _vtx.size(), normal );
 
-    const osg::Vec3 ctr( p.x, p.y, p.z );
+}
 
-    // we build a bevelled box, without a bottom
-    // it's base is centerd on origin
+template<>
+void Mesh::push_back( const LWPOLY* lwpoly )
+{
+    assert( lwpoly );
+    addPolygon( LwPolygon( lwpoly ) );
+}
 
-    const float x = .5f*width;
 
-    const float y = .5f*depth;
 
-    const float e = width/20;
+Mesh::Mesh( const osg::Matrixd& layerToWord, Triangulator triangulator )
+    : _layerToWord( layerToWord )
+    , _triangulator( triangulator )
+    , _fullCheck( true )
+    , _timed( false )
+    , _instancedBars( false )
+{}
+
+// defined here, where Tessellator is complete
+Mesh::~Mesh()
+{}
+
+//! bevelled box, without a bottom, its base is centered on origin
+//! a vertex is unit * ( width, depth, height ) + bevel * width/20, so the
+//! same box is used for every bar, either copied or instanced
+struct BarTemplate {
+    enum { NUM_VERTICES = 20 };
+
+    osg::Vec3 unit[NUM_VERTICES];
+    osg::Vec3 bevel[NUM_VERTICES];
+    osg::Vec3 normal[NUM_VERTICES];
+    std::vector< unsigned short > indices;
+
+    BarTemplate() {
+        // vertex indices for base, top of the side faces and cap
+        const unsigned short b[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+        const unsigned short t[8] = { 8, 9, 10, 11, 12, 13, 14, 15 };
+        const unsigned short c[4] = { 16, 17, 18, 19 };
+
+        const float base[8][4] = { // unit x, unit y, bevel x, bevel y
+            { -.5f, -.5f,  1,  0 },
+            {  .5f, -.5f, -1,  0 },
+            {  .5f, -.5f,  0,  1 },
+            {  .5f,  .5f,  0, -1 },
+            {  .5f,  .5f, -1,  0 },
+            { -.5f,  .5f,  1,  0 },
+            { -.5f,  .5f,  0, -1 },
+            { -.5f, -.5f,  0,  1 }
+        };
+
+        const osg::Vec3 nb[8] = {
+            osg::Vec3( 0, -1, 0 ),
+            osg::Vec3( 0, -1, 0 ),
+            osg::Vec3( 1,  0, 0 ),
+            osg::Vec3( 1,  0, 0 ),
+            osg::Vec3( 0,  1, 0 ),
+            osg::Vec3( 0,  1, 0 ),
+            osg::Vec3( -1,  0, 0 ),
+            osg::Vec3( -1,  0, 0 )
+        };
+
+        for ( size_t i=0; i<8; i++ ) {
+            unit[b[i]] = osg::Vec3( base[i][0], base[i][1], 0 );
+            bevel[b[i]] = osg::Vec3( base[i][2], base[i][3], 0 );
+            normal[b[i]] = nb[i];
+            // top of the sides is a bevel below the cap
+            unit[t[i]] = osg::Vec3( base[i][0], base[i][1], 1 );
+            bevel[t[i]] = osg::Vec3( base[i][2], base[i][3], -1 );
+            normal[t[i]] = nb[i]; // same nrml as bottom
+        }
 
-    const unsigned o = unsigned( _vtx.size() );
+        const float cap[4][2] = { { -.5f, -.5f }, { .5f, -.5f }, { .5f, .5f }, { -.5f, .5f } };
 
-    // vertex indices for base, top of the side faces and cap
-    const unsigned b[8] = { o, o+1, o+2, o+3, o+4, o+5, o+6, o+7 };
+        for ( size_t i=0; i<4; i++ ) {
+            unit[c[i]] = osg::Vec3( cap[i][0], cap[i][1], 1 );
+            bevel[c[i]] = osg::Vec3( cap[i][0] < 0 ? 1 : -1, cap[i][1] < 0 ? 1 : -1, 0 );
+            normal[c[i]] = osg::Vec3( 0, 0, 1 );
+        }
 
-    const unsigned t[8] = { o+8, o+9, o+10, o+11, o+12, o+13, o+14, o+15 };
+        // sides, loop / indices
+        for ( size_t i=0; i<8; i++ ) {
+            indices.push_back( b[i] );
+            indices.push_back( b[( i+1 )%8] );
+            indices.push_back( t[i] );
+            indices.push_back( t[i] );
+            indices.push_back( b[( i+1 )%8] );
+            indices.push_back( t[( i+1 )%8] );
+        }
 
-    const unsigned c[4] = { o+16, o+17, o+18, o+19 };
+        // top
+        indices.push_back( c[0] );
+        indices.push_back( c[1] );
+        indices.push_back( c[2] );
+        indices.push_back( c[0] );
+        indices.push_back( c[2] );
+        indices.push_back( c[3] );
+
+        // top bevel
+        for ( size_t i=0; i<4; i++ ) {
+            indices.push_back( t[( i*2 )%8] );
+            indices.push_back( t[( i*2+1 )%8] );
+            indices.push_back( c[i] );
+            indices.push_back( c[i] );
+            indices.push_back( t[( i*2+1 )%8] );
+            indices.push_back( c[( i+1 )%4] );
+        }
 
-    const osg::Vec3 vb[8] = {
-        osg::Vec3( -x+e, -y  , 0 ),
-        osg::Vec3( x-e, -y  , 0 ),
-        osg::Vec3( x  , -y+e, 0 ),
-        osg::Vec3( x  ,  y-e, 0 ),
-        osg::Vec3( x-e,  y  , 0 ),
-        osg::Vec3( -x+e,  y  , 0 ),
-        osg::Vec3( -x  ,  y-e, 0 ),
-        osg::Vec3( -x  , -y+e, 0 )
-    };
+        // top corners
+        for ( size_t i=0; i<4; i++ ) {
+            indices.push_back( t[( i*2+1 )%8] );
+            indices.push_back( t[( i*2+2 )%8] );
+            indices.push_back( c[( i+1 )%4] );
+        }
+    }
+};
 
-    const osg::Vec3 nb[8] = {
-        osg::Vec3( 0, -1, 0 ),
-        osg::Vec3( 0, -1, 0 ),
-        osg::Vec3( 1,  0, 0 ),
-        osg::Vec3( 1,  0, 0 ),
-        osg::Vec3( 0,  1, 0 ),
-        osg::Vec3( 0,  1, 0 ),
-        osg::Vec3( -1,  0, 0 ),
-        osg::Vec3( -1,  0, 0 )
-    };
+inline
+const BarTemplate& barTemplate()
+{
+    static const BarTemplate bar;
+    return bar;
+}
 
-    osg::Vec3 vt[8];
+// we create the box triangles ourselves since an osg::Box for each feature is really slow
+template<>
+void Mesh::addBar( const LWGEOM* lwgeom, float width, float depth, float height, const osg::Vec4& color )
+{
+    LWPOINT* lwpoint = lwgeom_as_lwpoint( lwgeom );
 
-    for ( size_t i=0; i<8; i++ ) {
-        vt[i] = vb[i] + osg::Vec3( 0,0,height-e );
+    if( !lwpoint ) {
+        throw std::runtime_error( "failed to get points from WKB" );
     }
 
+    const POINT3DZ p = getPoint3dz( lwpoint->point, 0 );
 
-    const osg::Vec3 vc[4] = {
-        osg::Vec3( -x+e, -y+e, height ),
-        osg::Vec3( x-e, -y+e, height ),
-        osg::Vec3( x-e,  y-e, height ),
-        osg::Vec3( -x+e,  y-e, height )
-    };
+    const osg::Vec3d ctr( p.x, p.y, p.z );
 
-    const osg::Vec3 nc[4] = {
-        osg::Vec3( 0, 0, 1 ),
-        osg::Vec3( 0, 0, 1 ),
-        osg::Vec3( 0, 0, 1 ),
-        osg::Vec3( 0, 0, 1 )
-    };
+    const osg::Vec3 bc = ctr*_layerToWord; // in double precision
 
-    _vtx.insert( _vtx.end(), vb, vb+8 );
+    if ( _instancedBars ) {
+        _barPosition.push_back( bc );
+        _barSize.push_back( osg::Vec3( width, depth, height ) );
+        _barColor.push_back( color );
+        return;
+    }
 
-    _nrml.insert( _nrml.end(), nb, nb+8 );
+    const BarTemplate& bar = barTemplate();
 
-    _vtx.insert( _vtx.end(), vt, vt+8 );
+    const osg::Vec3 size( width, depth, height );
 
-    _nrml.insert( _nrml.end(), nb, nb+8 ); // same nrml as bottom
+    const float e = width/20;
 
-    _vtx.insert( _vtx.end(), vc, vc+4 );
+    const unsigned o = unsigned( _vtx.size() );
 
-    _nrml.insert( _nrml.end(), nc, nc+4 );
+    for ( size_t i=0; i<BarTemplate::NUM_VERTICES; i++ ) {
+        _vtx.push_back( osg::componentMultiply( bar.unit[i], size ) + bar.bevel[i] * e + bc );
+        _nrml.push_back( bar.normal[i] );
+    }
 
-    // sides, loop / indices
-    for ( size_t i=0; i<8; i++ ) {
-        _tri.push_back( b[i] );
-        _tri.push_back( b[( i+1 )%8] );
-        _tri.push_back( t[i] );
-        _tri.push_back( t[i] );
-        _tri.push_back( b[( i+1 )%8] );
-        _tri.push_back( t[( i+1 )%8] );
+    for ( size_t i=0; i<bar.indices.size(); i++ ) {
+        _tri.push_back( o + bar.indices[i] );
     }
+}
 
-    // top
-    _tri.push_back( c[0] );
-    _tri.push_back( c[1] );
-    _tri.push_back( c[2] );
-    _tri.push_back( c[0] );
-    _tri.push_back( c[2] );
-    _tri.push_back( c[3] );
+void Mesh::addBar( WKB center, float width, float depth, float height, const osg::Vec4& color )
+{
+    Lwgeom lwgeom( center );
 
-    // top bevel
-    for ( size_t i=0; i<4; i++ ) {
-        _tri.push_back( t[( i*2 )%8] );
-        _tri.push_back( t[( i*2+1 )%8] );
-        _tri.push_back( c[i] );
-        _tri.push_back( c[i] );
-        _tri.push_back( t[( i*2+1 )%8] );
-        _tri.push_back( c[( i+1 )%4] );
+    if ( !lwgeom.get() ) {
+        return;    // the error reporter takes care of errors
     }
 
-    // top corners
-    for ( size_t i=0; i<4; i++ ) {
-        _tri.push_back( t[( i*2+1 )%8] );
-        _tri.push_back( t[( i*2+2 )%8] );
-        _tri.push_back( c[( i+1 )%4] );
-    }
+    addBar( lwgeom.get(), width, depth, height, color );
+}
 
-    // translate all vtx by base center
-    const osg::Vec3 bc = ctr*_layerToWord;
-    const size_t sz = _vtx.size();
-    assert( _vtx.size() - o == 20 );
+void Mesh::addBar( RawWKB center, float width, float depth, float height, const osg::Vec4& color )
+{
+    Lwgeom lwgeom( center );
 
-    for ( size_t i=o; i<sz; i++ ) {
-        _vtx[i] += bc;
+    if ( !lwgeom.get() ) {
+        return;    // the error reporter takes care of errors
     }
+
+    addBar( lwgeom.get(), width, depth, height, color );
 }
 
-template<>
-void Mesh::push_back( const LWTRIANGLE* lwtriangle )
+template< typename RING >
+void Mesh::addTriangle( const RING& ring, bool hasZ )
 {
-    assert( lwtriangle );
+    if ( ring.size() < 3 ) {
+        return;
+    }
+
     const int offset = _vtx.size();
 
-    for( int v = 0; v < 3; v++ ) {
-        const POINT3DZ p3D = getPoint3dz( lwtriangle->points, v );
-        const osg::Vec3d p( p3D.x, p3D.y, p3D.z );
-        _vtx.push_back( p * _layerToWord );
-    }
+    _vtx.resize( offset + 3 );
+    transformRing( ring, 3, _layerToWord, _coordinates, _vtx[offset].ptr() );
 
     for ( int i=0; i<3; i++ ) {
         _tri.push_back( i + offset );
@@ -997,17 +1835,21 @@ void Mesh::push_back( const LWTRIANGLE* lwtriangle )
 
     osg::Vec3 normal( 0.0, 0.0, 0.0 );
 
-    for ( int i = 0; i < 3; ++i ) {
-        osg::Vec3 pi = _vtx[offset+i];
-        osg::Vec3 pj = _vtx[offset +( ( i+1 ) % 3 ) ];
-        normal[0] += ( pi[1] - pj[1] ) * ( pi[2] + pj[2] );
-        normal[1] += ( pi[2] - pj[2] ) * ( pi[0] + pj[0] );
-        normal[2] += ( pi[0] - pj[0] ) * ( pi[1] + pj[1] );
-    }
+    {
+        ScopedTiming timing( _timed, _timings.normals );
+
+        for ( int i = 0; i < 3; ++i ) {
+            osg::Vec3 pi = _vtx[offset+i];
+            osg::Vec3 pj = _vtx[offset +( ( i+1 ) % 3 ) ];
+            normal[0] += ( pi[1] - pj[1] ) * ( pi[2] + pj[2] );
+            normal[1] += ( pi[2] - pj[2] ) * ( pi[0] + pj[0] );
+            normal[2] += ( pi[0] - pj[0] ) * ( pi[1] + pj[1] );
+        }
 
-    normal.normalize();
+        normal.normalize();
+    }
 
-    if ( ( FLAGS_GET_Z( lwtriangle->flags ) == 0 ) && ( normal[2] < 0 ) ) {
+    if ( !hasZ && ( normal[2] < 0 ) ) {
         // if this is a 2D surface and the normal is pointing down, reverse the triangle
         normal[2] = 1;
         std::swap( _tri[ offset ], _tri[offset + 2] );
@@ -1018,6 +1860,13 @@ void Mesh::push_back( const LWTRIANGLE* lwtriangle )
     }
 }
 
+template<>
+void Mesh::push_back( const LWTRIANGLE* lwtriangle )
+{
+    assert( lwtriangle );
+    addTriangle( LwRing( lwtriangle->points ), FLAGS_GET_Z( lwtriangle->flags ) );
+}
+
 template< typename MULTITYPE >
 void Mesh::push_back( const MULTITYPE* lwmulti )
 {
@@ -1082,18 +1931,259 @@ void Mesh::push_back( const LWGEOM* lwgeom )
 
 void Mesh::push_back( WKT wkt )
 {
+    ScopedTiming decoding( _timed, _timings.decode );
     Lwgeom lwgeom( wkt );
+    decoding.stop();
     assert( lwgeom.get() ); // error reporter will take care of errors
     push_back( lwgeom.get() );
 }
 
 void Mesh::push_back( WKB wkb )
 {
+    ScopedTiming decoding( _timed, _timings.decode );
+
+    // hex decoding in a buffer kept between features
+    const char* hex = wkb.get();
+    const size_t size = std::strlen( hex ) / 2;
+    _wkb.resize( size );
+
+    for ( size_t i = 0; i < size; i++ ) {
+        const int hi = hexValue( hex[2*i] );
+        const int lo = hexValue( hex[2*i+1] );
+
+        if ( hi < 0 || lo < 0 ) {
+            throw std::runtime_error( "invalid character in hex encoded WKB" );
+        }
+
+        _wkb[i] = static_cast< unsigned char >( hi * 16 + lo );
+    }
+
+    decoding.stop();
+
+    if ( size ) {
+        push_back( RawWKB( &_wkb[0], size ) );
+    }
+}
+
+void Mesh::push_back( RawWKB wkb )
+{
+    WkbStream stream( wkb.get(), wkb.size() );
+
+    if ( stream.handled() ) {
+        push_back( stream );
+        return;
+    }
+
+    // other types go through liblwgeom
+    ScopedTiming decoding( _timed, _timings.decode );
     Lwgeom lwgeom( wkb );
+    decoding.stop();
     assert( lwgeom.get() ); // error reporter will take care of errors
     push_back( lwgeom.get() );
 }
 
+//! adds the size of the mesh of the geometry at the cursor to numVertices and numTriangles
+//! a polygon of n points (in all its r rings) has about n vertices and n + 2r - 4 triangles
+//! @note types that are not handled without liblwgeom are not counted
+inline
+void estimateSize( WkbStream& wkb, size_t& numVertices, size_t& numTriangles )
+{
+    switch ( wkb.header() ) {
+    case WkbStream::POLYGON: {
+        size_t numPoints = 0;
+        const uint32_t numRings = wkb.skipPolygon( numPoints );
+        numVertices += numPoints;
+        numTriangles += std::max( numPoints + 2 * numRings, size_t( 4 ) ) - 4;
+        break;
+    }
+    case WkbStream::TRIANGLE: {
+        size_t numPoints = 0;
+        wkb.skipPolygon( numPoints );
+        numVertices += 3;
+        numTriangles += 1;
+        break;
+    }
+    case WkbStream::MULTIPOLYGON:
+    case WkbStream::POLYHEDRALSURFACE:
+    case WkbStream::TIN: {
+        const uint32_t numGeoms = wkb.readUInt32();
+
+        for ( uint32_t g = 0; g < numGeoms; g++ ) {
+            estimateSize( wkb, numVertices, numTriangles );
+        }
+
+        break;
+    }
+    default:
+        throw std::runtime_error( "geometry type not handled without liblwgeom" );
+    }
+}
+
+void Mesh::estimateSize( RawWKB wkb, size_t& numVertices, size_t& numTriangles )
+{
+    WkbStream stream( wkb.get(), wkb.size() );
+
+    try {
+        osgGIS::estimateSize( stream, numVertices, numTriangles );
+    }
+    catch ( std::exception& ) {
+        // truncated WKB or type not handled, what was counted is a lower bound
+    }
+}
+
+void Mesh::reserve( size_t numVertices, size_t numTriangles )
+{
+    _vtx.reserve( _vtx.size() + numVertices );
+    _nrml.reserve( _nrml.size() + numVertices );
+    _tri.reserve( _tri.size() + 3 * numTriangles );
+}
+
+void Mesh::reserveBars( size_t numBars )
+{
+    if ( _instancedBars ) {
+        _barPosition.reserve( _barPosition.size() + numBars );
+        _barSize.reserve( _barSize.size() + numBars );
+        _barColor.reserve( _barColor.size() + numBars );
+    }
+    else {
+        const BarTemplate& bar = barTemplate();
+        reserve( numBars * BarTemplate::NUM_VERTICES, numBars * bar.indices.size() / 3 );
+    }
+}
+
+void Mesh::push_back( WkbStream& wkb )
+{
+    const uint32_t type = wkb.header();
+
+    switch ( type ) {
+    case WkbStream::POLYGON: {
+        ScopedTiming decoding( _timed, _timings.decode );
+        const WkbPolygon polygon( wkb.polygon() );
+        decoding.stop();
+        addPolygon( polygon );
+        break;
+    }
+    case WkbStream::TRIANGLE: {
+        ScopedTiming decoding( _timed, _timings.decode );
+        const WkbPolygon triangle( wkb.polygon() );
+        decoding.stop();
+
+        if ( triangle.numRings() ) {
+            addTriangle( triangle.ring( 0 ), triangle.hasZ() );
+        }
+
+        break;
+    }
+    case WkbStream::MULTIPOLYGON:
+    case WkbStream::POLYHEDRALSURFACE:
+    case WkbStream::TIN: {
+        const uint32_t numGeoms = wkb.readUInt32();
+
+        for ( uint32_t g = 0; g < numGeoms; g++ ) {
+            push_back( wkb );
+        }
+
+        break;
+    }
+    default:
+        throw std::runtime_error( "unexpected geometry type in WKB collection" );
+    }
+}
+
+void Mesh::append( const Mesh& other )
+{
+    assert( _layerToWord == other._layerToWord );
+    assert( _vtx.size() == _nrml.size() );
+
+    const unsigned offset = unsigned( _vtx.size() );
+    _vtx.insert( _vtx.end(), other._vtx.begin(), other._vtx.end() );
+    _nrml.insert( _nrml.end(), other._nrml.begin(), other._nrml.end() );
+
+    const size_t sz = _tri.size();
+    _tri.insert( _tri.end(), other._tri.begin(), other._tri.end() );
+
+    for ( std::vector<unsigned>::iterator i = _tri.begin() + sz; i != _tri.end(); ++i ) {
+        *i += offset;
+    }
+
+    _stats.fan += other._stats.fan;
+    _stats.glu += other._stats.glu;
+    _stats.cdt += other._stats.cdt;
+    _stats.fallback += other._stats.fallback;
+    _timings.decode += other._timings.decode;
+    _timings.tessellation += other._timings.tessellation;
+    _timings.normals += other._timings.normals;
+
+    _barPosition.insert( _barPosition.end(), other._barPosition.begin(), other._barPosition.end() );
+    _barSize.insert( _barSize.end(), other._barSize.begin(), other._barSize.end() );
+    _barColor.insert( _barColor.end(), other._barColor.begin(), other._barColor.end() );
+}
+
+//! vertex and normal, quantized
+struct WeldKey {
+    WeldKey( const osg::Vec3& v, const osg::Vec3& n, float tolerance, float normalTolerance ) {
+        for ( int i=0; i<3; i++ ) {
+            cell[i] = static_cast< long long >( std::floor( v[i] / tolerance ) );
+            cell[i+3] = static_cast< long long >( std::floor( n[i] / normalTolerance ) );
+        }
+    }
+
+    bool operator==( const WeldKey& other ) const {
+        return std::equal( cell, cell+6, other.cell );
+    }
+
+    long long cell[6];
+};
+
+struct WeldKeyHash {
+    size_t operator()( const WeldKey& key ) const {
+        size_t h = 0;
+
+        for ( int i=0; i<6; i++ ) {
+            h = h * 1000003 ^ static_cast< size_t >( key.cell[i] );
+        }
+
+        return h;
+    }
+};
+
+size_t Mesh::weld( float tolerance, float normalTolerance )
+{
+    assert( tolerance > 0 && normalTolerance > 0 );
+    assert( _vtx.size() == _nrml.size() );
+
+    const size_t numVtx = _vtx.size();
+
+    std::unordered_map< WeldKey, unsigned, WeldKeyHash > index;
+    index.reserve( numVtx );
+
+    // new index for each old vertex, the first of each cell is kept, in order
+    std::vector< unsigned > remap( numVtx );
+    size_t kept = 0;
+
+    for ( size_t i=0; i<numVtx; i++ ) {
+        const std::pair< std::unordered_map< WeldKey, unsigned, WeldKeyHash >::iterator, bool > inserted =
+            index.insert( std::make_pair( WeldKey( _vtx[i], _nrml[i], tolerance, normalTolerance ), unsigned( kept ) ) );
+
+        if ( inserted.second ) {
+            _vtx[kept] = _vtx[i];
+            _nrml[kept] = _nrml[i];
+            ++kept;
+        }
+
+        remap[i] = inserted.first->second;
+    }
+
+    _vtx.resize( kept );
+    _nrml.resize( kept );
+
+    for ( std::vector<unsigned>::iterator t = _tri.begin(); t != _tri.end(); ++t ) {
+        *t = remap[*t];
+    }
+
+    return numVtx - kept;
+}
+
 osg::Geometry* Mesh::createGeometry() const
 {
     osg::ref_ptr<osg::Geometry> multi = new osg::Geometry();
@@ -1110,4 +2200,289 @@ osg::Geometry* Mesh::createGeometry() const
     return multi.release();
 }
 
+//! normal packed in bytes, GL maps them back to [-1,1]
+inline
+osg::Vec3b packNormal( const osg::Vec3& n )
+{
+    return osg::Vec3b( static_cast<signed char>( osg::round( osg::clampBetween( n.x(), -1.f, 1.f ) * 127 ) ),
+                       static_cast<signed char>( osg::round( osg::clampBetween( n.y(), -1.f, 1.f ) * 127 ) ),
+                       static_cast<signed char>( osg::round( osg::clampBetween( n.z(), -1.f, 1.f ) * 127 ) ) );
+}
+
+osg::Node* Mesh::createCompactGeometry( bool quantizePositions ) const
+{
+    const unsigned MAX_CHUNK_VERTICES = 65535;
+
+    // positions are quantized in the bound of the mesh: q in [-32768,32767] maps
+    // to [min,max], the transform above the geode restores them
+    osg::BoundingBox bound;
+
+    for ( std::vector<osg::Vec3>::const_iterator v = _vtx.begin(); v != _vtx.end(); ++v ) {
+        bound.expandBy( *v );
+    }
+
+    // the step is the same on all axes: a non uniform scale would change the direction
+    // of the normals, that GL transforms by the inverse transpose of the matrix
+    float uniformStep = 0;
+
+    for ( int i=0; i<3 && bound.valid(); i++ ) {
+        uniformStep = std::max( uniformStep, ( bound._max[i] - bound._min[i] ) / 65535 );
+    }
+
+    const osg::Vec3 step( osg::Vec3( 1, 1, 1 ) * ( uniformStep > 0 ? uniformStep : 1 ) );
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+
+    // index of the vertices in the current chunk, valid if stamped with the chunk number
+    std::vector< unsigned > local( _vtx.size() );
+    std::vector< unsigned > stamp( _vtx.size(), 0 );
+    unsigned chunk = 0;
+
+    osg::ref_ptr<osg::Vec3Array> vertices;
+    osg::ref_ptr<osg::Vec3sArray> quantized;
+    osg::ref_ptr<osg::Vec3bArray> normals;
+    osg::ref_ptr<osg::DrawElementsUShort> elem;
+    osg::ref_ptr<osg::Geometry> geometry;
+
+    // osg cannot compute the bound of Vec3s vertices, it is given as initial bound
+    // of each chunk, in quantized coordinates
+    osg::BoundingBox quantizedBound;
+
+    for ( size_t t = 0; t < _tri.size(); t += 3 ) {
+        // a new chunk if the triangle may not fit
+        if ( !elem.valid() || normals->size() + 3 > MAX_CHUNK_VERTICES ) {
+            if ( quantizePositions && geometry.valid() ) {
+                geometry->setInitialBound( quantizedBound );
+            }
+
+            ++chunk;
+            vertices = new osg::Vec3Array;
+            quantized = new osg::Vec3sArray;
+            normals = new osg::Vec3bArray;
+            elem = new osg::DrawElementsUShort( GL_TRIANGLES );
+            quantizedBound.init();
+
+            geometry = new osg::Geometry;
+            geometry->setUseVertexBufferObjects( true );
+
+            if ( quantizePositions ) {
+                geometry->setVertexArray( quantized.get() );
+            }
+            else {
+                geometry->setVertexArray( vertices.get() );
+            }
+
+            geometry->setNormalArray( normals.get() );
+            geometry->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+            geometry->addPrimitiveSet( elem.get() );
+            geode->addDrawable( geometry.get() );
+        }
+
+        for ( size_t i = t; i < t + 3; i++ ) {
+            const unsigned v = _tri[i];
+
+            if ( stamp[v] != chunk ) {
+                stamp[v] = chunk;
+                local[v] = unsigned( normals->size() );
+                normals->push_back( packNormal( _nrml[v] ) );
+
+                if ( quantizePositions ) {
+                    const osg::Vec3 q( osg::componentDivide( _vtx[v] - bound._min, step ) );
+                    quantized->push_back( osg::Vec3s( short( osg::round( q.x() ) - 32768 ),
+                                                      short( osg::round( q.y() ) - 32768 ),
+                                                      short( osg::round( q.z() ) - 32768 ) ) );
+                    quantizedBound.expandBy( quantized->back().x(), quantized->back().y(), quantized->back().z() );
+                }
+                else {
+                    vertices->push_back( _vtx[v] );
+                }
+            }
+
+            elem->push_back( static_cast<GLushort>( local[v] ) );
+        }
+    }
+
+    if ( !quantizePositions ) {
+        return geode.release();
+    }
+
+    if ( geometry.valid() ) {
+        geometry->setInitialBound( quantizedBound );
+    }
+
+    osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform;
+    transform->setMatrix( osg::Matrix::scale( step ) * osg::Matrix::translate( bound.valid() ? bound._min + step * 32768 : osg::Vec3() ) );
+    transform->addChild( geode.get() );
+
+    // the uniform scale keeps the direction of normals, not their length
+    transform->getOrCreateStateSet()->setMode( GL_NORMALIZE, osg::StateAttribute::ON );
+    return transform.release();
+}
+
+osg::Geometry* Mesh::releaseGeometry()
+{
+    osg::ref_ptr<osg::Geometry> multi = new osg::Geometry();
+    multi->setUseVertexBufferObjects( true );
+
+    // the arrays adopt our buffers, nothing is copied
+    osg::ref_ptr<osg::Vec3Array> vertices( new osg::Vec3Array );
+    vertices->asVector().swap( _vtx );
+    multi->setVertexArray( vertices.get() );
+    osg::ref_ptr<osg::Vec3Array> normals( new osg::Vec3Array );
+    normals->asVector().swap( _nrml );
+    multi->setNormalArray( normals.get() );
+    multi->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+
+    osg::ref_ptr<osg::DrawElementsUInt> elem = new osg::DrawElementsUInt( GL_TRIANGLES );
+    elem->asVector().swap( _tri );
+    multi->addPrimitiveSet( elem.get() );
+
+    // the buffers we got are empty, their capacity is released too
+    std::vector<osg::Vec3>().swap( _vtx );
+    std::vector<osg::Vec3>().swap( _nrml );
+    std::vector<unsigned>().swap( _tri );
+    return multi.release();
+}
+
+const char* const BAR_VERTEX_SHADER =
+    "#version 120\n"
+    "attribute vec3 bevel;\n"
+    "attribute vec3 barPosition;\n"
+    "attribute vec3 barSize;\n"
+    "attribute vec4 barColor;\n"
+    "varying vec3 normal;\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 v = gl_Vertex.xyz * barSize + bevel * ( barSize.x / 20.0 ) + barPosition;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4( v, 1.0 );\n"
+    "    normal = gl_NormalMatrix * gl_Normal;\n"
+    "    color = barColor;\n"
+    "}\n";
+
+const char* const BAR_FRAGMENT_SHADER =
+    "#version 120\n"
+    "varying vec3 normal;\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    float diffuse = max( dot( normalize( normal ), normalize( gl_LightSource[0].position.xyz ) ), 0.0 );\n"
+    "    vec3 ambientLight = gl_LightSource[0].ambient.rgb + gl_LightModel.ambient.rgb;\n"
+    "    vec3 diffuseLight = diffuse * gl_LightSource[0].diffuse.rgb;\n"
+    "    if ( color.a > 0.0 ) {\n"
+    "        gl_FragColor = vec4( color.rgb * ( ambientLight + diffuseLight ), color.a );\n"
+    "    }\n"
+    "    else { // no color for this bar, the material of the layer is used\n"
+    "        gl_FragColor = vec4( gl_FrontMaterial.ambient.rgb * ambientLight\n"
+    "                             + gl_FrontMaterial.diffuse.rgb * diffuseLight, gl_FrontMaterial.diffuse.a );\n"
+    "    }\n"
+    "}\n";
+
+//! the vertices of the box are around the origin, the bound is computed from the
+//! instances arrays, so it follows changes of the positions (e.g. draping) after dirtyBound()
+struct InstancesBound : osg::Drawable::ComputeBoundingBoxCallback {
+    virtual osg::BoundingBox computeBound( const osg::Drawable& drawable ) const {
+        osg::BoundingBox bound;
+        const osg::Geometry* geometry = drawable.asGeometry();
+        const osg::Vec3Array* position = geometry ? dynamic_cast<const osg::Vec3Array*>( geometry->getVertexAttribArray( Mesh::BAR_POSITION ) ) : NULL;
+        const osg::Vec3Array* size = geometry ? dynamic_cast<const osg::Vec3Array*>( geometry->getVertexAttribArray( Mesh::BAR_SIZE ) ) : NULL;
+
+        if ( !position || !size ) {
+            return bound;
+        }
+
+        for ( size_t i=0; i<position->size() && i<size->size(); i++ ) {
+            const osg::Vec3& p = ( *position )[i];
+            const osg::Vec3& s = ( *size )[i];
+            bound.expandBy( p - osg::Vec3( s.x(), s.y(), 0 ) * .5f );
+            bound.expandBy( p + osg::Vec3( s.x()*.5f, s.y()*.5f, s.z() ) );
+        }
+
+        return bound;
+    }
+};
+
+osg::Geometry* Mesh::createInstancedBars() const
+{
+    if ( _barPosition.empty() ) {
+        return NULL;
+    }
+
+    const BarTemplate& bar = barTemplate();
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+    geometry->setUseDisplayList( false );
+    geometry->setUseVertexBufferObjects( true );
+
+    geometry->setVertexArray( new osg::Vec3Array( bar.unit, bar.unit + BarTemplate::NUM_VERTICES ) );
+    geometry->setNormalArray( new osg::Vec3Array( bar.normal, bar.normal + BarTemplate::NUM_VERTICES ) );
+    geometry->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    geometry->setVertexAttribArray( Mesh::BAR_BEVEL, new osg::Vec3Array( bar.bevel, bar.bevel + BarTemplate::NUM_VERTICES ) );
+    geometry->setVertexAttribBinding( Mesh::BAR_BEVEL, osg::Geometry::BIND_PER_VERTEX );
+
+    // one element per instance, thanks to the divisors
+    geometry->setVertexAttribArray( Mesh::BAR_POSITION, new osg::Vec3Array( _barPosition.begin(), _barPosition.end() ) );
+    geometry->setVertexAttribBinding( Mesh::BAR_POSITION, osg::Geometry::BIND_PER_VERTEX );
+    geometry->setVertexAttribArray( Mesh::BAR_SIZE, new osg::Vec3Array( _barSize.begin(), _barSize.end() ) );
+    geometry->setVertexAttribBinding( Mesh::BAR_SIZE, osg::Geometry::BIND_PER_VERTEX );
+    geometry->setVertexAttribArray( Mesh::BAR_COLOR, new osg::Vec4Array( _barColor.begin(), _barColor.end() ) );
+    geometry->setVertexAttribBinding( Mesh::BAR_COLOR, osg::Geometry::BIND_PER_VERTEX );
+
+    geometry->addPrimitiveSet( new osg::DrawElementsUShort( GL_TRIANGLES, bar.indices.size(), &bar.indices[0], _barPosition.size() ) );
+
+    geometry->setComputeBoundingBoxCallback( new InstancesBound );
+
+    // the callback is not saved in .osgb files (tile cache), the initial bound is
+    geometry->setInitialBound( geometry->getBound() );
+
+    osg::ref_ptr<osg::Program> program = new osg::Program;
+    program->addShader( new osg::Shader( osg::Shader::VERTEX, BAR_VERTEX_SHADER ) );
+    program->addShader( new osg::Shader( osg::Shader::FRAGMENT, BAR_FRAGMENT_SHADER ) );
+    program->addBindAttribLocation( "bevel", Mesh::BAR_BEVEL );
+    program->addBindAttribLocation( "barPosition", Mesh::BAR_POSITION );
+    program->addBindAttribLocation( "barSize", Mesh::BAR_SIZE );
+    program->addBindAttribLocation( "barColor", Mesh::BAR_COLOR );
+
+    osg::StateSet* stateset = geometry->getOrCreateStateSet();
+    stateset->setAttributeAndModes( program.get() );
+    stateset->setAttribute( new osg::VertexAttribDivisor( Mesh::BAR_POSITION, 1 ) );
+    stateset->setAttribute( new osg::VertexAttribDivisor( Mesh::BAR_SIZE, 1 ) );
+    stateset->setAttribute( new osg::VertexAttribDivisor( Mesh::BAR_COLOR, 1 ) );
+
+    return geometry.release();
+}
+
+//! finds the instanced bars geometries, e.g. in a tile read from the cache
+struct InstancedBarsVisitor : osg::NodeVisitor {
+    InstancedBarsVisitor()
+        : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+        , found( 0 )
+    {}
+
+    virtual void apply( osg::Geode& geode ) {
+        for ( unsigned i = 0; i < geode.getNumDrawables(); i++ ) {
+            osg::Geometry* geometry = geode.getDrawable( i )->asGeometry();
+
+            if ( geometry && geometry->getVertexAttribArray( Mesh::BAR_POSITION ) ) {
+                geometry->setComputeBoundingBoxCallback( new InstancesBound );
+                // the initial bound is a union with the computed one, it is reset
+                geometry->setInitialBound( osg::BoundingBox() );
+                geometry->dirtyBound();
+                ++found;
+            }
+        }
+
+        traverse( geode );
+    }
+
+    size_t found;
+};
+
+size_t Mesh::restoreInstancedBars( osg::Node& node )
+{
+    InstancedBarsVisitor visitor;
+    node.accept( visitor );
+    return visitor.found;
+}
+
 }
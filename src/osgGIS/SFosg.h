@@ -24,6 +24,9 @@
 #endif
 
 #include <osg/Geometry>
+#include <osg/Node>
+
+#include <memory>
 
 namespace osgGIS {
 
@@ -46,34 +49,214 @@ struct WKB: ConstCharWrapper {
     WKB( const char* data ): ConstCharWrapper( data ) {}
 };
 
+//! binary WKB (or EWKB), as returned by postgres in binary mode, as opposed
+//! to WKB wich is hex encoded
+struct RawWKB {
+    RawWKB( const unsigned char* data, size_t size ): _data( data ), _size( size ) {}
+    const unsigned char* get() const {
+        return _data;
+    }
+    size_t size() const {
+        return _size;
+    }
+private :
+    const unsigned char* _data ;
+    size_t _size;
+};
+
+struct Tessellator;
+struct WkbStream;
+
 //! @brief build an osg::Geometry from WKT or WKB represenations
 //! @note this structure avoids the creation of many small osg::geometries (slow)
+//! @note the tessellation state belongs to the mesh, different meshes can be
+//!       filled concurrently from different threads
 struct Mesh {
+    //! algorithm used for polygons that are not triangulated as fans
+    enum Triangulator {
+        GLU, //!< GLU tessellator
+        CDT  //!< poly2tri constrained delaunay triangulation, better shaped triangles,
+             //!< polygons it fails on are given to GLU
+    };
+
     //! @param layerToWord transformation from GIS CRS (layer) to OpenGL scene (world)
     //!        the aim is mainly to center the scene around origin to avoid round-off errors
-    Mesh( const osg::Matrixd& layerToWord )
-        : _layerToWord( layerToWord )
-    {}
+    Mesh( const osg::Matrixd& layerToWord, Triangulator triangulator = GLU );
+
+    ~Mesh();
 
 
     void push_back( WKB geometry );
     void push_back( WKT geometry );
+    void push_back( RawWKB geometry );
+
+    //! @param color only used by instanced bars, a null alpha (the default) means
+    //!        the diffuse and ambient colors of the material (e.g. the layer's fill color)
+    void addBar( WKB center, float width, float depth, float height, const osg::Vec4& color = osg::Vec4( 0, 0, 0, 0 ) );
+    void addBar( RawWKB center, float width, float depth, float height, const osg::Vec4& color = osg::Vec4( 0, 0, 0, 0 ) );
+
+    //! bars are then stored as instances of a single bevelled box (position, size and color)
+    //! instead of 20 vertices each, and are drawn by createInstancedBars()
+    void enableInstancedBars( bool enable = true ) {
+        _instancedBars = enable;
+    }
+
+    //! number of instanced bars
+    size_t numBars() const {
+        return _barPosition.size();
+    }
+
+    //! append the triangles of another mesh (with the same layerToWord), after ours
+    //! @note this is used to merge meshes filled concurrently
+    void append( const Mesh& other );
+
+    //! merge vertices with the same position and normal, the triangles then share them
+    //! @param tolerance vertices are merged if they fall in the same cell of a grid of this size
+    //! @param normalTolerance same for normals
+    //! @return the number of vertices removed
+    size_t weld( float tolerance, float normalTolerance = 1e-3f );
+
+    size_t numVertices() const {
+        return _vtx.size();
+    }
+
+    size_t numTriangles() const {
+        return _tri.size() / 3;
+    }
 
-    void addBar( WKB center, float width, float depth, float height );
+    //! adds the estimated size of the mesh of a WKB geometry to numVertices and numTriangles,
+    //! from its point counts, without decoding the coordinates
+    //! @note truncated WKB and types that are not handled directly are not counted
+    static void estimateSize( RawWKB geometry, size_t& numVertices, size_t& numTriangles );
+
+    //! reserve room for numVertices more vertices and numTriangles more triangles,
+    //! to avoid reallocations while the mesh is filled
+    void reserve( size_t numVertices, size_t numTriangles );
+
+    //! reserve room for numBars more bars, instanced or not
+    void reserveBars( size_t numBars );
 
     osg::Geometry* createGeometry() const;
 
+    //! compact version of createGeometry() to save GPU memory: geometries of at most
+    //! 65535 vertices with 16 bits indices, and normals packed in bytes
+    //! @param quantizePositions positions are also stored as 16 bits integers in the
+    //!        bound of the mesh, the geode is then under a MatrixTransform that restores them
+    //! @return a geode, or the transform of the geode if positions are quantized
+    osg::Node* createCompactGeometry( bool quantizePositions = false ) const;
+
+    //! vertices, e.g. to drape them on a terrain before the geometry is created
+    std::vector<osg::Vec3>& vertices() {
+        return _vtx;
+    }
+
+    //! same as createGeometry(), but the geometry adopts the buffers of the mesh
+    //! instead of copying them, the mesh has no vertices left
+    osg::Geometry* releaseGeometry();
+
+    //! vertex attribute locations of the instanced bars geometry
+    enum BarAttribute {
+        BAR_BEVEL = 6,    //!< per vertex, offset of the bevel, scaled by width/20
+        BAR_POSITION = 7, //!< per instance, center of the base
+        BAR_SIZE = 8,     //!< per instance, width, depth, height
+        BAR_COLOR = 9     //!< per instance, null alpha for the material
+    };
+
+    //! @return the instanced bars, drawn with a single glDrawElementsInstanced, NULL if there is none
+    //! @note the geometry has its own program, the vertex shader places and scales the box
+    osg::Geometry* createInstancedBars() const;
+
+    //! the bound callback of instanced bars is not saved in .osgb files, it is set
+    //! again on the geometries of the node that have a BAR_POSITION array
+    //! @return the number of instanced bars geometries found
+    static size_t restoreInstancedBars( osg::Node& node );
+
+    //! number of polygons triangulated by each method
+    struct TessellationStats {
+        TessellationStats(): fan( 0 ), glu( 0 ), cdt( 0 ), fallback( 0 ) {}
+        size_t fan;      //!< convex polygons without holes, triangulated directly
+        size_t glu;      //!< other polygons, triangulated by the GLU tessellator
+        size_t cdt;      //!< other polygons, triangulated by poly2tri
+        size_t fallback; //!< polygons poly2tri failed on, also counted in glu
+    };
+
+    const TessellationStats& tessellationStats() const {
+        return _stats;
+    }
+
+    //! time spent in the steps of the conversion, in seconds
+    struct Timings {
+        Timings(): decode( 0 ), tessellation( 0 ), normals( 0 ) {}
+        double decode;       //!< parsing of WKB/WKT
+        double tessellation; //!< triangulation of polygons
+        double normals;      //!< computation of normals
+    };
+
+    //! poly2tri needs valid polygons, by default they are fully checked (ring self
+    //! intersections and intersections between rings), this can be disabled for
+    //! trusted data, a crossing then makes poly2tri fail and the polygon goes to GLU
+    void enableFullCheck( bool enable = true ) {
+        _fullCheck = enable;
+    }
+
+    //! timings are disabled by default since they cost two clock reads per step
+    void enableTimings( bool enable = true ) {
+        _timed = enable;
+    }
+
+    const Timings& timings() const {
+        return _timings;
+    }
+
 private:
     std::vector<osg::Vec3> _vtx;
     std::vector<osg::Vec3> _nrml;
     std::vector<unsigned> _tri;
     const osg::Matrixd _layerToWord;
+    const Triangulator _triangulator;
+    bool _fullCheck;
+    std::vector<osg::Vec3> _ring; // exterior ring of the current polygon, capacity is kept between polygons
+    std::vector<unsigned char> _wkb; // decoded hex WKB, capacity is kept between features
+    std::vector<double> _coordinates; // ring coordinates copied from WKB, capacity is kept between rings
+    TessellationStats _stats;
+    bool _timed;
+    Timings _timings;
+    bool _instancedBars;
+    std::vector<osg::Vec3> _barPosition; // center of the base, in world coordinates
+    std::vector<osg::Vec3> _barSize;     // width, depth, height
+    std::vector<osg::Vec4> _barColor;
+    std::unique_ptr< Tessellator > _tessellator; // created on first use, reused for all polygons
 
     template< typename GEOM >
     void push_back( const GEOM* );  // utility fonction, specialised for several types
 
+    //! polygons and triangles are read directly from WKB, without liblwgeom
+    void push_back( WkbStream& );
+
+    //! @param polygon gives access to rings, either from liblwgeom or from WKB
+    template< typename POLYGON >
+    void addPolygon( const POLYGON& polygon );
+
+    //! @throw std::runtime_error if the polygon is invalid or poly2tri fails
+    template< typename POLYGON >
+    void addPolygonCdt( const POLYGON& polygon );
+
+    template< typename POLYGON >
+    void addPolygonGlu( const POLYGON& polygon );
+
+    template< typename RING >
+    void addTriangle( const RING& ring, bool hasZ );
+
+    template< typename GEOM >
+    void addBar( const GEOM*, float width, float depth, float height, const osg::Vec4& color );
+
     //! @note this is needed for glu tesselation to avoid exposing vtx and tri members
     friend void CALLBACK tessVertexCB( const GLdouble* vtx, void* data );
+    friend void CALLBACK tessCombineCB( GLdouble coords[3], GLdouble* vertexData[4], GLfloat weight[4], void** outData, void* data );
+
+    // non copyable
+    Mesh( const Mesh& );
+    Mesh operator=( const Mesh& );
 
 };
 
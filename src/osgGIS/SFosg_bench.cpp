@@ -0,0 +1,482 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "SFosg.h"
+
+#include <osg/Timer>
+#include <osg/Vec2d>
+
+extern "C" {
+#include <liblwgeom.h>
+}
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+// benchmark of the conversion of WKB to osg::Geometry
+//
+// usage: SFosg_bench [-n numFeatures] [recorded.hexwkb ...]
+//
+// each corpus is converted with both triangulators: glu, and cdt (poly2tri) with
+// full validity check of polygons, or without (cdt-)
+//
+// bars are converted as meshes and as instances
+//
+// synthetic corpora are generated, recorded ones are files with one hex encoded
+// WKB per line, e.g. from: psql -At -c "SELECT geom FROM bati_tin" > bati_tin.hexwkb
+
+typedef std::vector< unsigned char > Feature;
+
+struct Corpus {
+    Corpus( const std::string& n ): name( n ) {}
+    const std::string name;
+    std::vector< Feature > features;
+
+    //! add a feature as EWKB, like postgis sends it in binary mode
+    void addWkt( const std::string& wkt ) {
+        LWGEOM* lwgeom = lwgeom_from_wkt( wkt.c_str(), LW_PARSER_CHECK_NONE );
+        size_t size;
+        uint8_t* wkb = lwgeom_to_wkb( lwgeom, WKB_EXTENDED | WKB_NDR, &size );
+        features.push_back( Feature( wkb, wkb + size ) );
+        lwfree( wkb );
+        lwgeom_free( lwgeom );
+    }
+};
+
+// deterministic pseudo random numbers in [0,1), to compare runs
+struct Random {
+    Random(): _state( 1 ) {}
+    double operator()() {
+        _state = _state * 1103515245 + 12345;
+        return double( ( _state / 65536 ) % 32768 ) / 32768;
+    }
+private:
+    unsigned long _state;
+};
+
+//! footprint of a building, a rotated rectangle or an L shape, counterclockwise
+inline
+const std::vector< osg::Vec2d > footprint( Random& random )
+{
+    const osg::Vec2d origin( 1000 * random(), 1000 * random() );
+    const double w = 5 + 20 * random();
+    const double h = 5 + 20 * random();
+    const double a = 2 * M_PI * random();
+    const osg::Vec2d u( std::cos( a ), std::sin( a ) );
+    const osg::Vec2d v( -u.y(), u.x() );
+
+    std::vector< osg::Vec2d > ring;
+
+    if ( random() < .5 ) {
+        const double c[4][2] = {{0, 0}, {w, 0}, {w, h}, {0, h}};
+
+        for ( int i=0; i<4; i++ ) {
+            ring.push_back( origin + u * c[i][0] + v * c[i][1] );
+        }
+    }
+    else {
+        const double c[6][2] = {{0, 0}, {w, 0}, {w, h/2}, {w/2, h/2}, {w/2, h}, {0, h}};
+
+        for ( int i=0; i<6; i++ ) {
+            ring.push_back( origin + u * c[i][0] + v * c[i][1] );
+        }
+    }
+
+    return ring;
+}
+
+inline
+const std::string ringWkt( const std::vector< osg::Vec2d >& ring, const double* z = NULL, bool reverse = false )
+{
+    std::stringstream wkt;
+    wkt << std::setprecision( 16 ) << "(";
+    const size_t n = ring.size();
+
+    for ( size_t i=0; i<=n; i++ ) {
+        const osg::Vec2d& p = ring[ reverse ? ( n - i ) % n : i % n ];
+        wkt << ( i ? "," : "" ) << p.x() << " " << p.y();
+
+        if ( z ) {
+            wkt << " " << *z;
+        }
+    }
+
+    wkt << ")";
+    return wkt.str();
+}
+
+inline
+const Corpus footprints( size_t n )
+{
+    Corpus corpus( "footprints" );
+    Random random;
+
+    for ( size_t f=0; f<n; f++ ) {
+        corpus.addWkt( "POLYGON(" + ringWkt( footprint( random ) ) + ")" );
+    }
+
+    return corpus;
+}
+
+//! footprints extruded as polyhedral surfaces (walls and roof, no floor)
+inline
+const Corpus buildings( size_t n )
+{
+    Corpus corpus( "buildings" );
+    Random random;
+
+    for ( size_t f=0; f<n; f++ ) {
+        const std::vector< osg::Vec2d > ring( footprint( random ) );
+        const double height = 3 + 30 * random();
+        std::stringstream wkt;
+        wkt << std::setprecision( 16 ) << "POLYHEDRALSURFACE Z(";
+
+        for ( size_t i=0; i<ring.size(); i++ ) {
+            const osg::Vec2d& a = ring[i];
+            const osg::Vec2d& b = ring[( i+1 ) % ring.size()];
+            wkt << "((" << a.x() << " " << a.y() << " 0,"
+                << b.x() << " " << b.y() << " 0,"
+                << b.x() << " " << b.y() << " " << height << ","
+                << a.x() << " " << a.y() << " " << height << ","
+                << a.x() << " " << a.y() << " 0)),";
+        }
+
+        wkt << "(" << ringWkt( ring, &height ) << "))";
+        corpus.addWkt( wkt.str() );
+    }
+
+    return corpus;
+}
+
+//! terrain patches of 8x8 cells, two triangles per cell
+inline
+const Corpus tins( size_t n )
+{
+    Corpus corpus( "tins" );
+    Random random;
+    const int cells = 8;
+
+    for ( size_t f=0; f<n; f++ ) {
+        const osg::Vec2d origin( 1000 * random(), 1000 * random() );
+        double z[cells+1][cells+1];
+
+        for ( int i=0; i<=cells; i++ ) {
+            for ( int j=0; j<=cells; j++ ) {
+                z[i][j] = 10 * random();
+            }
+        }
+
+        std::stringstream wkt;
+        wkt << std::setprecision( 16 ) << "TIN Z(";
+
+        for ( int i=0; i<cells; i++ ) {
+            for ( int j=0; j<cells; j++ ) {
+                const double x0 = origin.x() + i, x1 = x0 + 1, y0 = origin.y() + j, y1 = y0 + 1;
+                wkt << ( i || j ? "," : "" )
+                    << "((" << x0 << " " << y0 << " " << z[i][j] << ","
+                    << x1 << " " << y0 << " " << z[i+1][j] << ","
+                    << x1 << " " << y1 << " " << z[i+1][j+1] << ","
+                    << x0 << " " << y0 << " " << z[i][j] << ")),"
+                    << "((" << x0 << " " << y0 << " " << z[i][j] << ","
+                    << x1 << " " << y1 << " " << z[i+1][j+1] << ","
+                    << x0 << " " << y1 << " " << z[i][j+1] << ","
+                    << x0 << " " << y0 << " " << z[i][j] << "))";
+            }
+        }
+
+        wkt << ")";
+        corpus.addWkt( wkt.str() );
+    }
+
+    return corpus;
+}
+
+//! squares with a 10x10 grid of square holes
+inline
+const Corpus holes( size_t n )
+{
+    Corpus corpus( "holes" );
+    Random random;
+    const int grid = 10;
+
+    for ( size_t f=0; f<n; f++ ) {
+        const osg::Vec2d origin( 1000 * random(), 1000 * random() );
+        std::vector< osg::Vec2d > ring;
+        ring.push_back( origin );
+        ring.push_back( origin + osg::Vec2d( 2*grid+1, 0 ) );
+        ring.push_back( origin + osg::Vec2d( 2*grid+1, 2*grid+1 ) );
+        ring.push_back( origin + osg::Vec2d( 0, 2*grid+1 ) );
+        std::string wkt = "POLYGON(" + ringWkt( ring );
+
+        for ( int i=0; i<grid; i++ ) {
+            for ( int j=0; j<grid; j++ ) {
+                const osg::Vec2d o = origin + osg::Vec2d( 2*i+1, 2*j+1 );
+                ring[0] = o;
+                ring[1] = o + osg::Vec2d( 1, 0 );
+                ring[2] = o + osg::Vec2d( 1, 1 );
+                ring[3] = o + osg::Vec2d( 0, 1 );
+                wkt += "," + ringWkt( ring, NULL, true ); // clockwise
+            }
+        }
+
+        corpus.addWkt( wkt + ")" );
+    }
+
+    return corpus;
+}
+
+//! lakes, noisy discs of 10k vertices with an island of 1k vertices, to time the validity
+//! check of polygons for poly2tri
+inline
+const Corpus lakes( size_t n )
+{
+    Corpus corpus( "lakes" );
+    Random random;
+
+    for ( size_t f=0; f<n; f++ ) {
+        const osg::Vec2d center( 10000 * random(), 10000 * random() );
+        std::vector< osg::Vec2d > shore;
+        std::vector< osg::Vec2d > island;
+
+        for ( int i=0; i<10000; i++ ) {
+            const double a = 2 * M_PI * i / 10000;
+            shore.push_back( center + osg::Vec2d( std::cos( a ), std::sin( a ) ) * 1000 * ( .9 + .1 * random() ) );
+        }
+
+        for ( int i=0; i<1000; i++ ) {
+            const double a = 2 * M_PI * i / 1000;
+            island.push_back( center + osg::Vec2d( std::cos( a ), std::sin( a ) ) * 100 * ( .9 + .1 * random() ) );
+        }
+
+        corpus.addWkt( "POLYGON(" + ringWkt( shore ) + "," + ringWkt( island, NULL, true ) + ")" );
+    }
+
+    return corpus;
+}
+
+//! one hex encoded WKB per line
+inline
+const Corpus recorded( const std::string& fileName )
+{
+    Corpus corpus( fileName );
+    std::ifstream file( fileName.c_str() );
+    std::string line;
+
+    while ( std::getline( file, line ) ) {
+        Feature feature( line.size() / 2 );
+
+        for ( size_t i=0; i<feature.size(); i++ ) {
+            feature[i] = static_cast< unsigned char >( std::strtol( line.substr( 2*i, 2 ).c_str(), NULL, 16 ) );
+        }
+
+        if ( !feature.empty() ) {
+            corpus.features.push_back( feature );
+        }
+    }
+
+    if ( corpus.features.empty() ) {
+        std::cerr << "warning: no feature in " << fileName << "\n";
+    }
+
+    return corpus;
+}
+
+inline
+void bench( const Corpus& corpus, osgGIS::Mesh::Triangulator triangulator, bool fullCheck = true )
+{
+    osgGIS::Mesh mesh( osg::Matrix::identity(), triangulator );
+    mesh.enableTimings();
+    mesh.enableFullCheck( fullCheck );
+
+    size_t bytes = 0;
+    size_t failures = 0;
+
+    osg::Timer timer;
+
+    // like the plugin, room is made from the WKB point counts before conversion
+    size_t numVertices = 0;
+    size_t numTriangles = 0;
+
+    for ( size_t f=0; f<corpus.features.size(); f++ ) {
+        osgGIS::Mesh::estimateSize( osgGIS::RawWKB( &corpus.features[f][0], corpus.features[f].size() ), numVertices, numTriangles );
+    }
+
+    mesh.reserve( numVertices, numTriangles );
+
+    for ( size_t f=0; f<corpus.features.size(); f++ ) {
+        const Feature& feature = corpus.features[f];
+        bytes += feature.size();
+
+        try {
+            mesh.push_back( osgGIS::RawWKB( &feature[0], feature.size() ) );
+        }
+        catch ( std::exception& ) {
+            ++failures;
+        }
+    }
+
+    const double conversion = timer.time_s();
+
+    timer.setStartTick();
+    osg::ref_ptr< osg::Geometry > geometry = mesh.releaseGeometry();
+    const double creation = timer.time_s();
+
+    const size_t n = corpus.features.size();
+    const osgGIS::Mesh::Timings& t = mesh.timings();
+
+    std::cout << std::setw( 12 ) << corpus.name
+              << std::setw( 5 ) << ( triangulator == osgGIS::Mesh::GLU ? "glu" : ( fullCheck ? "cdt" : "cdt-" ) )
+              << std::setw( 9 ) << n
+              << std::setw( 9 ) << ( n ? bytes / n : 0 )
+              << std::fixed << std::setprecision( 4 )
+              << std::setw( 10 ) << t.decode
+              << std::setw( 10 ) << t.tessellation
+              << std::setw( 10 ) << t.normals
+              << std::setw( 10 ) << conversion - t.decode - t.tessellation - t.normals
+              << std::setw( 10 ) << creation
+              << std::setprecision( 0 )
+              << std::setw( 12 ) << n / ( conversion + creation )
+              << std::setw( 9 ) << geometry->getVertexArray()->getNumElements()
+              << std::setw( 7 ) << mesh.tessellationStats().fan
+              << std::setw( 7 ) << mesh.tessellationStats().glu
+              << std::setw( 7 ) << mesh.tessellationStats().cdt
+              << std::setw( 7 ) << mesh.tessellationStats().fallback
+              << std::setw( 5 ) << failures
+              << "\n";
+}
+
+//! bars as 20 vertices each or as instances of a single box, the vertex data
+//! is what is uploaded to the GPU for each
+inline
+void benchBars( size_t n, bool instanced )
+{
+    osgGIS::Mesh mesh( osg::Matrix::identity() );
+    mesh.enableInstancedBars( instanced );
+
+    Random random;
+    std::vector< Feature > points;
+
+    for ( size_t i=0; i<n; i++ ) {
+        Corpus corpus( "" );
+        std::stringstream wkt;
+        wkt << std::setprecision( 16 ) << "POINT(" << 10000 * random() << " " << 10000 * random() << ")";
+        corpus.addWkt( wkt.str() );
+        points.push_back( corpus.features[0] );
+    }
+
+    osg::Timer timer;
+
+    mesh.reserveBars( n );
+
+    for ( size_t i=0; i<n; i++ ) {
+        mesh.addBar( osgGIS::RawWKB( &points[i][0], points[i].size() ), 10, 10, 100 * random() );
+    }
+
+    const double conversion = timer.time_s();
+
+    timer.setStartTick();
+    osg::ref_ptr< osg::Geometry > geometry = instanced ? mesh.createInstancedBars() : mesh.createGeometry();
+    const double creation = timer.time_s();
+
+    size_t bytes = 0;
+
+    for ( unsigned a=0; a<16; a++ ) {
+        if ( geometry->getVertexAttribArray( a ) ) {
+            bytes += geometry->getVertexAttribArray( a )->getTotalDataSize();
+        }
+    }
+
+    bytes += geometry->getVertexArray()->getTotalDataSize() + geometry->getNormalArray()->getTotalDataSize();
+
+    std::cout << std::setw( 12 ) << ( instanced ? "instanced" : "mesh" )
+              << std::setw( 9 ) << n
+              << std::fixed << std::setprecision( 4 )
+              << std::setw( 10 ) << conversion
+              << std::setw( 10 ) << creation
+              << std::setw( 12 ) << bytes
+              << "\n";
+}
+
+int main( int argc, char** argv )
+{
+    size_t numFeatures = 10000;
+    std::vector< std::string > files;
+
+    for ( int a=1; a<argc; a++ ) {
+        if ( "-n" == std::string( argv[a] ) && a+1 < argc ) {
+            numFeatures = std::atoi( argv[++a] );
+        }
+        else {
+            files.push_back( argv[a] );
+        }
+    }
+
+    std::vector< Corpus > corpora;
+    corpora.push_back( footprints( numFeatures ) );
+    corpora.push_back( buildings( numFeatures ) );
+    corpora.push_back( tins( numFeatures / 10 ) );
+    corpora.push_back( holes( numFeatures / 100 ) );
+    corpora.push_back( lakes( std::max< size_t >( 1, numFeatures / 1000 ) ) );
+
+    for ( size_t f=0; f<files.size(); f++ ) {
+        corpora.push_back( recorded( files[f] ) );
+    }
+
+    // times in seconds
+    std::cout << std::setw( 12 ) << "corpus"
+              << std::setw( 5 ) << "tri."
+              << std::setw( 9 ) << "features"
+              << std::setw( 9 ) << "bytes/f"
+              << std::setw( 10 ) << "decode"
+              << std::setw( 10 ) << "tessel."
+              << std::setw( 10 ) << "normals"
+              << std::setw( 10 ) << "other"
+              << std::setw( 10 ) << "geometry"
+              << std::setw( 12 ) << "features/s"
+              << std::setw( 9 ) << "vertices"
+              << std::setw( 7 ) << "fan"
+              << std::setw( 7 ) << "glu"
+              << std::setw( 7 ) << "cdt"
+              << std::setw( 7 ) << "fallb."
+              << std::setw( 5 ) << "err"
+              << "\n";
+
+    for ( size_t c=0; c<corpora.size(); c++ ) {
+        bench( corpora[c], osgGIS::Mesh::GLU );
+        bench( corpora[c], osgGIS::Mesh::CDT );
+        bench( corpora[c], osgGIS::Mesh::CDT, false );
+    }
+
+    std::cout << "\n"
+              << std::setw( 12 ) << "bars"
+              << std::setw( 9 ) << "features"
+              << std::setw( 10 ) << "convert"
+              << std::setw( 10 ) << "geometry"
+              << std::setw( 12 ) << "bytes"
+              << "\n";
+
+    benchBars( numFeatures, false );
+    benchBars( numFeatures, true );
+
+    return EXIT_SUCCESS;
+}
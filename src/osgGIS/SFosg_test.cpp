@@ -19,11 +19,64 @@
 #include "SFosg.h"
 #include "TestGeometry.h"
 
+#include <osg/Vec2d>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 #include <osgGA/StateSetManipulator>
 
+extern "C" {
+#include <liblwgeom.h>
+}
+
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+
+//! @return true if the geometries have the same vertices and indices
+bool sameGeometry( const osg::Geometry* g1, const osg::Geometry* g2 )
+{
+    const osg::Vec3Array* v1 = dynamic_cast<const osg::Vec3Array*>( g1->getVertexArray() );
+    const osg::Vec3Array* v2 = dynamic_cast<const osg::Vec3Array*>( g2->getVertexArray() );
+    const osg::PrimitiveSet* p1 = g1->getPrimitiveSet( 0 );
+    const osg::PrimitiveSet* p2 = g2->getPrimitiveSet( 0 );
+
+    if ( v1->size() != v2->size() || p1->getNumIndices() != p2->getNumIndices() ) {
+        return false;
+    }
+
+    for ( size_t i=0; i<v1->size(); i++ ) {
+        if ( ( *v1 )[i] != ( *v2 )[i] ) {
+            return false;
+        }
+    }
+
+    for ( unsigned i=0; i<p1->getNumIndices(); i++ ) {
+        if ( p1->index( i ) != p2->index( i ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//! @return the sum of the areas of the triangles
+double area( const osg::Geometry* g )
+{
+    const osg::Vec3Array* v = dynamic_cast<const osg::Vec3Array*>( g->getVertexArray() );
+    const osg::PrimitiveSet* p = g->getPrimitiveSet( 0 );
+    double a = 0;
+
+    for ( unsigned i=0; i+2<p->getNumIndices(); i+=3 ) {
+        const osg::Vec3 u = ( *v )[p->index( i+1 )] - ( *v )[p->index( i )];
+        const osg::Vec3 w = ( *v )[p->index( i+2 )] - ( *v )[p->index( i )];
+        a += ( u ^ w ).length() / 2;
+    }
+
+    return a;
+}
 
 int main( int argc, char** argv )
 {
@@ -70,5 +123,305 @@ int main( int argc, char** argv )
         }
     }
 
+    // meshes filled separately then appended give the same geometry as a single mesh
+    {
+        const char* wkt[] = { "POLYGON((0 0,1 0,1 1,0 1,0 0))",
+                              "POLYGON((2 0,3 0,3 1,2 1,2 0),(2.2 .2,2.2 .8,2.8 .8,2.8 .2,2.2 .2))",
+                              "TRIANGLE((0 0 1,1 0 1,1 1 2,0 0 1))"
+                            };
+        const size_t n = sizeof( wkt )/sizeof( const char* );
+
+        osgGIS::Mesh single( osg::Matrix::identity() );
+        osgGIS::Mesh appended( osg::Matrix::identity() );
+
+        for ( size_t i=0; i<n; i++ ) {
+            single.push_back( osgGIS::WKT( wkt[i] ) );
+            osgGIS::Mesh part( osg::Matrix::identity() );
+            part.push_back( osgGIS::WKT( wkt[i] ) );
+            appended.append( part );
+        }
+
+        osg::ref_ptr<osg::Geometry> g1 = single.createGeometry();
+        osg::ref_ptr<osg::Geometry> g2 = appended.createGeometry();
+
+        if ( !sameGeometry( g1.get(), g2.get() ) ) {
+            std::cerr << "appended meshes differ from single mesh\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // geometries read directly from WKB, in both byte orders, are the same as
+    // the ones converted by liblwgeom
+    {
+        const char* wkt[] = { "POLYGON((0 0,1 0,1 1,0 1,0 0))",
+                              "SRID=2154;MULTIPOLYGON(((0 0,3 0,3 3,0 3,0 0),(1 1,1 2,2 2,2 1,1 1)),((4 0,5 0,4.5 1,5 2,4 2,4 0)))",
+                              "POLYHEDRALSURFACE Z(((0 0 0,0 1 0,1 1 0,1 0 0,0 0 0)),((0 0 0,0 0 1,0 1 1,0 1 0,0 0 0)))",
+                              "TIN ZM(((0 0 0 1,1 0 0 1,1 1 1 1,0 0 0 1)),((0 0 0 1,1 1 1 1,0 1 0 1,0 0 0 1)))",
+                              "TRIANGLE((0 0,0 1,1 1,0 0))",
+                              "POLYGON EMPTY"
+                            };
+        const uint8_t byteOrder[] = { WKB_NDR, WKB_XDR };
+
+        for ( size_t i=0; i<sizeof( wkt )/sizeof( const char* ); i++ ) {
+            for ( size_t o=0; o<2; o++ ) {
+                LWGEOM* lwgeom = lwgeom_from_wkt( wkt[i], LW_PARSER_CHECK_NONE );
+                size_t size;
+                uint8_t* wkb = lwgeom_to_wkb( lwgeom, WKB_EXTENDED | byteOrder[o], &size );
+
+                osgGIS::Mesh fromWkt( osg::Matrix::translate( -1, -1, 0 ) );
+                fromWkt.push_back( osgGIS::WKT( wkt[i] ) );
+                osgGIS::Mesh fromWkb( osg::Matrix::translate( -1, -1, 0 ) );
+                fromWkb.push_back( osgGIS::RawWKB( wkb, size ) );
+
+                lwfree( wkb );
+                lwgeom_free( lwgeom );
+
+                osg::ref_ptr<osg::Geometry> g1 = fromWkt.createGeometry();
+                osg::ref_ptr<osg::Geometry> g2 = fromWkb.createGeometry();
+
+                if ( !sameGeometry( g1.get(), g2.get() ) ) {
+                    std::cerr << "WKB and WKT conversions differ for " << wkt[i] << "\n";
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    // the size of the mesh is estimated from WKB point counts, and the released
+    // geometry is the same as the created one
+    {
+        const char* wkt[] = { "POLYGON((0 0,1 0,1 1,0 1,0 0))",
+                              "TIN Z(((0 0 0,1 0 0,1 1 1,0 0 0)),((0 0 0,1 1 1,0 1 0,0 0 0)))"
+                            };
+
+        for ( size_t i=0; i<sizeof( wkt )/sizeof( const char* ); i++ ) {
+            LWGEOM* lwgeom = lwgeom_from_wkt( wkt[i], LW_PARSER_CHECK_NONE );
+            size_t size;
+            uint8_t* wkb = lwgeom_to_wkb( lwgeom, WKB_EXTENDED | WKB_NDR, &size );
+
+            size_t numVertices = 0;
+            size_t numTriangles = 0;
+            osgGIS::Mesh::estimateSize( osgGIS::RawWKB( wkb, size ), numVertices, numTriangles );
+
+            osgGIS::Mesh mesh( osg::Matrix::identity() );
+            mesh.reserve( numVertices, numTriangles );
+            mesh.push_back( osgGIS::RawWKB( wkb, size ) );
+
+            lwfree( wkb );
+            lwgeom_free( lwgeom );
+
+            if ( numVertices != mesh.numVertices() || numTriangles != mesh.numTriangles() ) {
+                std::cerr << "wrong size estimate for " << wkt[i] << "\n";
+                return EXIT_FAILURE;
+            }
+
+            osg::ref_ptr<osg::Geometry> g1 = mesh.createGeometry();
+            osg::ref_ptr<osg::Geometry> g2 = mesh.releaseGeometry();
+
+            if ( !sameGeometry( g1.get(), g2.get() ) || mesh.numVertices() || mesh.numTriangles() ) {
+                std::cerr << "failed to release geometry of " << wkt[i] << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // compact geometries have at most 65535 vertices each, quantized positions are restored
+    // by the transform above them
+    {
+        std::stringstream wkt;
+        wkt << "TIN Z(";
+
+        for ( int i=0; i<25000; i++ ) {
+            wkt << ( i ? "," : "" ) << "((" << i << " 0 0," << i+1 << " 0 " << i%7 << "," << i << " 1 1," << i << " 0 0))";
+        }
+
+        wkt << ")";
+
+        osgGIS::Mesh mesh( osg::Matrix::identity() );
+        mesh.push_back( osgGIS::WKT( wkt.str().c_str() ) );
+
+        // normals of the float compact geometry, to check their direction once quantized
+        std::vector< osg::Vec3 > plainNormals;
+
+        for ( int quantized=0; quantized<2; quantized++ ) {
+            osg::ref_ptr< osg::Node > node = mesh.createCompactGeometry( quantized );
+            osg::MatrixTransform* transform = dynamic_cast< osg::MatrixTransform* >( node.get() );
+            osg::Geode* geode = dynamic_cast< osg::Geode* >( quantized ? ( transform ? transform->getChild( 0 ) : NULL ) : node.get() );
+
+            if ( !geode || geode->getNumDrawables() != 2 ) {
+                std::cerr << "failed to split the compact geometry\n";
+                return EXIT_FAILURE;
+            }
+
+            size_t numIndices = 0;
+
+            for ( unsigned d=0; d<geode->getNumDrawables(); d++ ) {
+                const osg::Geometry* geometry = geode->getDrawable( d )->asGeometry();
+
+                if ( geometry->getVertexArray()->getNumElements() > 65535
+                        || !dynamic_cast< const osg::DrawElementsUShort* >( geometry->getPrimitiveSet( 0 ) )
+                        || !dynamic_cast< const osg::Vec3bArray* >( geometry->getNormalArray() ) ) {
+                    std::cerr << "wrong compact geometry format\n";
+                    return EXIT_FAILURE;
+                }
+
+                numIndices += geometry->getPrimitiveSet( 0 )->getNumIndices();
+            }
+
+            // the first vertices of the first chunk are the first of the mesh
+            const osg::Geometry* first = geode->getDrawable( 0 )->asGeometry();
+
+            for ( size_t v=0; v<100; v++ ) {
+                osg::Vec3 position;
+
+                if ( quantized ) {
+                    const osg::Vec3s& q = ( *dynamic_cast< const osg::Vec3sArray* >( first->getVertexArray() ) )[v];
+                    position = osg::Vec3( q.x(), q.y(), q.z() ) * transform->getMatrix();
+                }
+                else {
+                    position = ( *dynamic_cast< const osg::Vec3Array* >( first->getVertexArray() ) )[v];
+                }
+
+                if ( ( position - mesh.vertices()[v] ).length() > 1 ) { // 25000/65535 step on x
+                    std::cerr << "wrong compact vertex position\n";
+                    return EXIT_FAILURE;
+                }
+
+                // GL transforms normals by the inverse transpose of the matrix
+                const osg::Vec3b& b = ( *dynamic_cast< const osg::Vec3bArray* >( first->getNormalArray() ) )[v];
+                osg::Vec3 normal( b.x(), b.y(), b.z() );
+
+                if ( quantized ) {
+                    normal = osg::Matrix::transform3x3( osg::Matrix::inverse( transform->getMatrix() ), normal );
+                    normal.normalize();
+
+                    if ( normal * plainNormals[v] < .99 ) {
+                        std::cerr << "wrong direction of quantized normal\n";
+                        return EXIT_FAILURE;
+                    }
+                }
+                else {
+                    normal.normalize();
+                    plainNormals.push_back( normal );
+                }
+            }
+
+            // the bound of quantized chunks is given, osg cannot compute it
+            if ( !geode->getBound().valid()
+                    || ( transform && !transform->getBound().contains( mesh.vertices()[0] ) ) ) {
+                std::cerr << "invalid bound of compact geometry\n";
+                return EXIT_FAILURE;
+            }
+
+            if ( numIndices != 3 * mesh.numTriangles() ) {
+                std::cerr << "missing triangles in compact geometry\n";
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // welding merges the vertices shared by coplanar triangles of a tin
+    {
+        osgGIS::Mesh mesh( osg::Matrix::identity() );
+        mesh.push_back( osgGIS::WKT( "TIN(((0 0 0,1 0 0,1 1 0,0 0 0)),((0 0 0,1 1 0,0 1 0,0 0 0)),((1 0 0,2 0 1,1 1 0,1 0 0)))" ) );
+
+        if ( mesh.numVertices() != 9 || mesh.weld( 1e-6f ) != 2 || mesh.numVertices() != 7 ) {
+            std::cerr << "failed to weld tin vertices\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // poly2tri triangulates a hole touching the exterior ring, and gives a bowtie to glu
+    {
+        osgGIS::Mesh mesh( osg::Matrix::identity(), osgGIS::Mesh::CDT );
+        mesh.push_back( osgGIS::WKT( "POLYGON((0 0,10 0,10 10,0 10,0 0),(0 0,2 5,5 2,0 0))" ) );
+        osg::ref_ptr< osg::Geometry > geometry = mesh.createGeometry();
+
+        if ( mesh.tessellationStats().cdt != 1 || std::abs( area( geometry.get() ) - 89.5 ) > .1 ) {
+            std::cerr << "failed to triangulate touching rings with poly2tri\n";
+            return EXIT_FAILURE;
+        }
+
+        mesh.push_back( osgGIS::WKT( "POLYGON((0 0,10 10,10 0,0 10,0 0))" ) );
+
+        if ( mesh.tessellationStats().fallback != 1 || mesh.tessellationStats().glu != 1 ) {
+            std::cerr << "failed to fall back to glu\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // large rings are checked for self intersection before poly2tri
+    {
+        std::vector< osg::Vec2d > star;
+
+        for ( int i=0; i<1000; i++ ) {
+            const double a = 2 * M_PI * i / 1000;
+            star.push_back( osg::Vec2d( std::cos( a ), std::sin( a ) ) * ( i%2 ? 2 : 1 ) );
+        }
+
+        for ( int crossed=0; crossed<2; crossed++ ) {
+            if ( crossed ) {
+                std::swap( star[100], star[600] );
+            }
+
+            std::stringstream wkt;
+            wkt << std::setprecision( 16 ) << "POLYGON((";
+
+            for ( size_t i=0; i<=star.size(); i++ ) {
+                wkt << ( i ? "," : "" ) << star[i%star.size()].x() << " " << star[i%star.size()].y();
+            }
+
+            wkt << "))";
+
+            osgGIS::Mesh mesh( osg::Matrix::identity(), osgGIS::Mesh::CDT );
+            mesh.push_back( osgGIS::WKT( wkt.str().c_str() ) );
+
+            if ( mesh.tessellationStats().cdt != size_t( !crossed ) || mesh.tessellationStats().fallback != size_t( crossed ) ) {
+                std::cerr << "failed to check self intersection of a large ring\n";
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // bars are either 20 vertices each or instances of a single box
+    {
+        const char* point = "0101000000000000000000F03F0000000000000040"; // POINT(1 2)
+
+        osgGIS::Mesh mesh( osg::Matrix::identity() );
+        mesh.addBar( osgGIS::WKB( point ), 2, 2, 3 );
+
+        if ( mesh.numVertices() != 20 || mesh.numBars() != 0 || osg::ref_ptr< osg::Geometry >( mesh.createInstancedBars() ).valid() ) {
+            std::cerr << "failed to create bar vertices\n";
+            return EXIT_FAILURE;
+        }
+
+        osgGIS::Mesh instanced( osg::Matrix::identity() );
+        instanced.enableInstancedBars();
+        instanced.addBar( osgGIS::WKB( point ), 2, 2, 3, osg::Vec4( 1, 0, 0, 1 ) );
+        instanced.addBar( osgGIS::WKB( point ), 2, 2, 5 );
+        osg::ref_ptr< osg::Geometry > bars = instanced.createInstancedBars();
+
+        if ( instanced.numVertices() != 0 || instanced.numBars() != 2 || !bars.valid()
+                || bars->getVertexArray()->getNumElements() != 20
+                || std::abs( bars->getBound().xMin() ) > 1e-6 || std::abs( bars->getBound().zMax() - 5 ) > 1e-6 ) {
+            std::cerr << "failed to create instanced bars\n";
+            return EXIT_FAILURE;
+        }
+
+        // the initial bound holds the bars without the bound callback, that is not saved in .osgb
+        if ( std::abs( bars->getInitialBound().zMax() - 5 ) > 1e-6 ) {
+            std::cerr << "missing initial bound of instanced bars\n";
+            return EXIT_FAILURE;
+        }
+
+        // bars without color use the material of the stateset
+        const osg::Vec4Array* colors = dynamic_cast< const osg::Vec4Array* >( bars->getVertexAttribArray( osgGIS::Mesh::BAR_COLOR ) );
+
+        if ( !colors || colors->size() != 2 || ( *colors )[0] != osg::Vec4( 1, 0, 0, 1 ) || ( *colors )[1].a() != 0 ) {
+            std::cerr << "wrong colors of instanced bars\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     return EXIT_SUCCESS;
 }
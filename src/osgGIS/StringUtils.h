@@ -57,6 +57,10 @@ struct AttributeMap: private std::map< std::string, std::string > {
         ( *this )[key] = val;
     }
 
+    void removeValue( const std::string& key ) {
+        erase( key );
+    }
+
     const std::string value( const std::string& key ) const {
         const const_iterator found = find( key );
 
@@ -71,6 +75,21 @@ struct AttributeMap: private std::map< std::string, std::string > {
         const const_iterator found = find( key );
         return found == end() ? "" : found->second;
     }
+
+    //! @return the space separated list of key="value", in key order, without keys
+    //!         starting with excludedPrefix if it's not empty
+    //! @note can be parsed back, the same attributes always give the same string
+    const std::string toString( const std::string& excludedPrefix = "" ) const {
+        std::string str;
+
+        for ( const_iterator i = begin(); i != end(); ++i ) {
+            if ( excludedPrefix.empty() || i->first.compare( 0, excludedPrefix.size(), excludedPrefix ) ) {
+                str += ( str.empty() ? "" : " " ) + i->first + "=\"" + escapeXMLString( i->second ) + "\"";
+            }
+        }
+
+        return str;
+    }
 };
 
 inline
@@ -0,0 +1,201 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TileCache.h"
+
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+
+namespace osgGIS {
+
+//! file of the cache, for eviction
+struct CachedFile {
+    CachedFile( const std::string& p, time_t t, uint64_t s ): path( p ), mtime( t ), size( s ) {}
+    bool operator<( const CachedFile& other ) const {
+        return mtime < other.mtime;
+    }
+    std::string path;
+    time_t mtime;
+    uint64_t size;
+};
+
+//! total size of the cache directories known to this process, caches are
+//! short lived (one per pseudo file) so the sizes outlive them
+struct DirectorySizes {
+    OpenThreads::Mutex mutex;
+    std::map< std::string, uint64_t > sizes;
+};
+
+static DirectorySizes& directorySizes()
+{
+    static DirectorySizes sizes;
+    return sizes;
+}
+
+TileCache::TileCache( const std::string& directory, uint64_t maxSize )
+    : _directory( directory )
+    , _maxSize( maxSize )
+{}
+
+const std::string TileCache::path( const std::string& key ) const
+{
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for ( std::string::const_iterator c = key.begin(); c != key.end(); ++c ) {
+        hash = ( hash ^ static_cast< unsigned char >( *c ) ) * 1099511628211ULL;
+    }
+
+    std::stringstream name;
+    name << std::hex << hash << ".osgb";
+    return osgDB::concatPaths( _directory, name.str() );
+}
+
+osg::Node* TileCache::read( const std::string& key ) const
+{
+    const std::string file = path( key );
+    std::ifstream in( file.c_str(), std::ios::binary );
+
+    if ( !in ) {
+        return NULL;
+    }
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
+
+    if ( !rw ) {
+        return NULL;
+    }
+
+    osgDB::ReaderWriter::ReadResult result = rw->readNode( in );
+
+    if ( !result.validNode() ) {
+        return NULL;
+    }
+
+    // last use, for eviction
+    utime( file.c_str(), NULL );
+
+    return result.takeNode();
+}
+
+bool TileCache::write( const std::string& key, const osg::Node& node ) const
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
+
+    if ( !rw || !osgDB::makeDirectory( _directory ) ) {
+        return false;
+    }
+
+    const std::string file = path( key );
+
+    // temporary files are numbered for concurrent writers of the same tile
+    static OpenThreads::Atomic counter;
+    std::stringstream tmp;
+    tmp << file << "." << getpid() << "." << ++counter << ".tmp";
+
+    {
+        std::ofstream out( tmp.str().c_str(), std::ios::binary );
+
+        if ( !out || !rw->writeNode( node, out ).success() || !out.flush() ) {
+            std::remove( tmp.str().c_str() );
+            return false;
+        }
+    }
+
+    if ( std::rename( tmp.str().c_str(), file.c_str() ) ) {
+        std::remove( tmp.str().c_str() );
+        return false;
+    }
+
+    struct stat st;
+    const uint64_t size = stat( file.c_str(), &st ) == 0 ? st.st_size : 0;
+
+    // the directory is only listed when the tracked size exceeds the maximum
+    // or is unknown, overwritten files are counted twice until the next scan
+    bool full = true;
+    {
+        DirectorySizes& ds = directorySizes();
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( ds.mutex );
+        std::map< std::string, uint64_t >::iterator tracked = ds.sizes.find( _directory );
+
+        if ( tracked != ds.sizes.end() ) {
+            tracked->second += size;
+            full = tracked->second > _maxSize;
+        }
+    }
+
+    if ( full ) {
+        evict();
+    }
+
+    return true;
+}
+
+void TileCache::evict() const
+{
+    const osgDB::DirectoryContents contents = osgDB::getDirectoryContents( _directory );
+
+    std::vector< CachedFile > files;
+    uint64_t totalSize = 0;
+
+    for ( osgDB::DirectoryContents::const_iterator f = contents.begin(); f != contents.end(); ++f ) {
+        // files being written are not ours to remove
+        if ( osgDB::getLowerCaseFileExtension( *f ) != "osgb" ) {
+            continue;
+        }
+
+        const std::string file = osgDB::concatPaths( _directory, *f );
+        struct stat st;
+
+        if ( stat( file.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) {
+            files.push_back( CachedFile( file, st.st_mtime, st.st_size ) );
+            totalSize += st.st_size;
+        }
+    }
+
+    if ( totalSize > _maxSize ) {
+        std::sort( files.begin(), files.end() );
+
+        // another process may remove the same files, failures are ignored
+        for ( std::vector< CachedFile >::const_iterator f = files.begin(); f != files.end() && totalSize > _maxSize; ++f ) {
+            std::remove( f->path.c_str() );
+            totalSize -= f->size;
+        }
+    }
+
+    DirectorySizes& ds = directorySizes();
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( ds.mutex );
+    ds.sizes[ _directory ] = totalSize;
+}
+
+}
@@ -0,0 +1,61 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STACK3D_OSGGIS_TILECACHE
+#define STACK3D_OSGGIS_TILECACHE
+
+#include <osg/Node>
+
+#include <string>
+#include <stdint.h>
+
+namespace osgGIS {
+
+//! on disk cache of the nodes built from postgis, one .osgb file per tile
+//! named after the hash of its key (e.g. the attributes of the pseudo file)
+//! @note the modification time of a file is its last use, the least recently
+//!       used files are removed when the total size exceeds the maximum size,
+//!       the total size is tracked in memory and the directory is only listed
+//!       when it exceeds the maximum (or on the first write of the process)
+struct TileCache {
+    //! @param maxSize in bytes
+    TileCache( const std::string& directory, uint64_t maxSize );
+
+    //! @return NULL if the key is not cached, the file is marked as used otherwise
+    osg::Node* read( const std::string& key ) const;
+
+    //! the node is written in a temporary file, renamed afterward so that concurrent
+    //! readers never see partial files, least recently used files are then evicted
+    //! if the tracked size of the directory exceeds maxSize
+    //! @return false if the node could not be written
+    bool write( const std::string& key, const osg::Node& node ) const;
+
+    //! list the directory, remove the least recently used files until the total
+    //! size is below maxSize and reset the tracked size
+    void evict() const;
+
+    const std::string path( const std::string& key ) const;
+
+private:
+    const std::string _directory;
+    const uint64_t _maxSize;
+};
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TileCache.h"
+#include "SFosg.h"
+
+#include <osg/Geode>
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+//! a geode with a single triangle
+osg::Geode* triangle()
+{
+    osg::ref_ptr< osg::Vec3Array > vertices = new osg::Vec3Array;
+    vertices->push_back( osg::Vec3( 0, 0, 0 ) );
+    vertices->push_back( osg::Vec3( 1, 0, 0 ) );
+    vertices->push_back( osg::Vec3( 0, 1, 0 ) );
+
+    osg::ref_ptr< osg::Geometry > geometry = new osg::Geometry;
+    geometry->setVertexArray( vertices.get() );
+    geometry->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLES, 0, 3 ) );
+
+    osg::ref_ptr< osg::Geode > geode = new osg::Geode;
+    geode->addDrawable( geometry.get() );
+    return geode.release();
+}
+
+//! @return true if the file exists
+bool exists( const std::string& file )
+{
+    struct stat st;
+    return stat( file.c_str(), &st ) == 0;
+}
+
+//! set the last use of a cached file
+void setUse( const std::string& file, time_t t )
+{
+    struct utimbuf times;
+    times.actime = t;
+    times.modtime = t;
+    utime( file.c_str(), &times );
+}
+
+int main( int, char** )
+{
+    std::stringstream directory;
+    directory << "TileCache_test." << getpid();
+
+    // the path only depends on the key, in the cache directory
+    {
+        const osgGIS::TileCache cache( directory.str(), 1024 * 1024 );
+        const osgGIS::TileCache other( directory.str(), 1 );
+
+        if ( cache.path( "a" ) != other.path( "a" ) || cache.path( "a" ) == cache.path( "b" )
+                || cache.path( "a" ).compare( 0, directory.str().size(), directory.str() )
+                || cache.path( "a" ).substr( cache.path( "a" ).size() - 5 ) != ".osgb" ) {
+            std::cerr << "wrong path of cached file " << cache.path( "a" ) << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // what is written is read back, missing keys are not found
+    {
+        const osgGIS::TileCache cache( directory.str(), 1024 * 1024 );
+
+        if ( cache.read( "a" ) ) {
+            std::cerr << "read a tile that is not in cache\n";
+            return EXIT_FAILURE;
+        }
+
+        osg::ref_ptr< osg::Geode > geode = triangle();
+
+        if ( !cache.write( "a", *geode ) ) {
+            std::cerr << "failed to write in cache\n";
+            return EXIT_FAILURE;
+        }
+
+        osg::ref_ptr< osg::Node > node = cache.read( "a" );
+        const osg::Geode* cached = dynamic_cast< const osg::Geode* >( node.get() );
+
+        if ( !cached || cached->getNumDrawables() != 1 || !cached->getDrawable( 0 )->asGeometry()
+                || cached->getDrawable( 0 )->asGeometry()->getVertexArray()->getNumElements() != 3 ) {
+            std::cerr << "failed to read back from cache\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the least recently used files are evicted
+    {
+        osg::ref_ptr< osg::Geode > geode = triangle();
+        const osgGIS::TileCache large( directory.str(), 1024 * 1024 );
+
+        if ( !large.write( "b", *geode ) ) {
+            std::cerr << "failed to write in cache\n";
+            return EXIT_FAILURE;
+        }
+
+        // b was used after a, then a is read
+        setUse( large.path( "a" ), 1000 );
+        setUse( large.path( "b" ), 2000 );
+        large.read( "a" );
+
+        struct stat st;
+        stat( large.path( "a" ).c_str(), &st );
+
+        // room for two tiles only, b is the least recently used
+        const osgGIS::TileCache small( directory.str(), 2 * st.st_size );
+
+        if ( !small.write( "c", *geode ) ) {
+            std::cerr << "failed to write in cache\n";
+            return EXIT_FAILURE;
+        }
+
+        if ( !exists( small.path( "a" ) ) || exists( small.path( "b" ) ) || !exists( small.path( "c" ) ) ) {
+            std::cerr << "wrong eviction of cached files\n";
+            return EXIT_FAILURE;
+        }
+
+        std::remove( small.path( "a" ).c_str() );
+        std::remove( small.path( "c" ).c_str() );
+    }
+
+    // instanced bars read back from the cache keep their bound
+    {
+        const char* point = "010100000000000000000059400000000000006940"; // POINT(100 200)
+
+        osgGIS::Mesh mesh( osg::Matrix::identity() );
+        mesh.enableInstancedBars();
+        mesh.addBar( osgGIS::WKB( point ), 2, 2, 3 );
+        mesh.addBar( osgGIS::WKB( point ), 2, 2, 5 );
+
+        osg::ref_ptr< osg::Geode > geode = new osg::Geode;
+        geode->addDrawable( mesh.createInstancedBars() );
+
+        const osgGIS::TileCache cache( directory.str(), 1024 * 1024 );
+
+        if ( !cache.write( "bars", *geode ) ) {
+            std::cerr << "failed to write bars in cache\n";
+            return EXIT_FAILURE;
+        }
+
+        osg::ref_ptr< osg::Node > node = cache.read( "bars" );
+        osg::Geode* cached = dynamic_cast< osg::Geode* >( node.get() );
+
+        if ( !cached || cached->getNumDrawables() != 1 || osgGIS::Mesh::restoreInstancedBars( *cached ) != 1 ) {
+            std::cerr << "failed to read bars from cache\n";
+            return EXIT_FAILURE;
+        }
+
+        // the template box is around the origin, it must not be in the bound
+        const osg::BoundingBox& bound = cached->getDrawable( 0 )->getBound();
+
+        if ( std::abs( bound.xMin() - 99 ) > 1e-3 || std::abs( bound.yMax() - 201 ) > 1e-3
+                || std::abs( bound.zMin() ) > 1e-3 || std::abs( bound.zMax() - 5 ) > 1e-3 ) {
+            std::cerr << "wrong bound of cached bars " << bound.xMin() << " " << bound.yMax() << " "
+                      << bound.zMin() << " " << bound.zMax() << "\n";
+            return EXIT_FAILURE;
+        }
+
+        std::remove( cache.path( "bars" ).c_str() );
+    }
+
+    rmdir( directory.str().c_str() );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/**
+ *   Horao
+ *
+ *   Copyright (C) 2013 Oslandia <infos@oslandia.com>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Library General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Library General Public License for more details.
+
+ *   You should have received a copy of the GNU Library General Public
+ *   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include "HoraoTile.h"
+
+#include <osgDB/ReadFile>
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+
+// converts a node to a Horao tile (.htile) that the htile plugin maps in memory
+//
+// usage: horaoTileWriter input output.htile
+//
+// the input is any file osg can read, e.g. a postgis pseudo file with the default
+// vertex_format (float):
+//   horaoTileWriter 'conn_info="dbname=lyon" origin="1841372 5174640 0" query="SELECT geom FROM bati".postgis' bati.htile
+//
+// the triangles of all geometries with float vertices and normals are merged,
+// transforms are ignored, instanced primitives are skipped (use bars="mesh")
+
+//! appends the triangles of geometries in the format of osgGIS::Mesh::createGeometry()
+struct MeshCollector : osg::NodeVisitor {
+    MeshCollector()
+        : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+        , skipped( 0 )
+    {}
+
+    virtual void apply( osg::Geode& geode ) {
+        for ( unsigned d = 0; d < geode.getNumDrawables(); d++ ) {
+            const osg::Geometry* geometry = geode.getDrawable( d )->asGeometry();
+            const osg::Vec3Array* vtx = geometry ? dynamic_cast< const osg::Vec3Array* >( geometry->getVertexArray() ) : NULL;
+            const osg::Vec3Array* nrml = geometry ? dynamic_cast< const osg::Vec3Array* >( geometry->getNormalArray() ) : NULL;
+
+            if ( !vtx || !nrml || nrml->size() != vtx->size() ) {
+                ++skipped;
+                continue;
+            }
+
+            const uint32_t offset = uint32_t( vertices.size() );
+            vertices.insert( vertices.end(), vtx->begin(), vtx->end() );
+            normals.insert( normals.end(), nrml->begin(), nrml->end() );
+
+            for ( unsigned p = 0; p < geometry->getNumPrimitiveSets(); p++ ) {
+                const osg::PrimitiveSet* primitives = geometry->getPrimitiveSet( p );
+
+                // instances are placed by a shader (e.g. bars="instanced"), the
+                // vertices are only the template
+                if ( primitives->getMode() != GL_TRIANGLES || primitives->getNumInstances() > 0 ) {
+                    ++skipped;
+                    continue;
+                }
+
+                for ( unsigned i = 0; i < primitives->getNumIndices(); i++ ) {
+                    indices.push_back( offset + primitives->index( i ) );
+                }
+            }
+        }
+    }
+
+    std::vector< osg::Vec3 > vertices;
+    std::vector< osg::Vec3 > normals;
+    std::vector< uint32_t > indices;
+    size_t skipped;
+};
+
+int main( int argc, char** argv )
+{
+    if ( argc != 3 ) {
+        std::cerr << "usage: " << argv[0] << " input output.htile\n";
+        return EXIT_FAILURE;
+    }
+
+    osg::ref_ptr< osg::Node > node = osgDB::readNodeFile( argv[1] );
+
+    if ( !node.valid() ) {
+        std::cerr << "failed to read " << argv[1] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    MeshCollector collector;
+    node->accept( collector );
+
+    if ( collector.skipped ) {
+        std::cerr << "warning: skipped " << collector.skipped << " geometries or primitive sets that are not float triangles or are instanced\n";
+    }
+
+    std::ofstream out( argv[2], std::ios::binary );
+
+    if ( !out || !osgGIS::writeHoraoTile( out,
+                                          collector.vertices.empty() ? NULL : &collector.vertices[0],
+                                          collector.normals.empty() ? NULL : &collector.normals[0],
+                                          uint32_t( collector.vertices.size() ),
+                                          collector.indices.empty() ? NULL : &collector.indices[0],
+                                          uint32_t( collector.indices.size() ) ) ) {
+        std::cerr << "failed to write " << argv[2] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "wrote " << collector.vertices.size() << " vertices and " << collector.indices.size() / 3 << " triangles in " << argv[2] << "\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/* 
+ * Poly2Tri Copyright (c) 2009-2010, Poly2Tri Contributors
+ * http://code.google.com/p/poly2tri/
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * * Neither the name of Poly2Tri nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "arena.h"
+#include <algorithm>
+
+namespace p2t {
+
+// max_align_t is not available with every compiler we support
+const size_t kAlignment = 2 * sizeof(double);
+
+Arena::Arena(size_t block_size) :
+  block_size_(block_size),
+  current_(0),
+  offset_(0)
+{
+}
+
+Arena::~Arena()
+{
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    delete [] blocks_[i].data;
+  }
+}
+
+void* Arena::Allocate(size_t size)
+{
+  size = (size + kAlignment - 1) & ~(kAlignment - 1);
+
+  while (current_ < blocks_.size()) {
+    const Block& block = blocks_[current_];
+    if (offset_ + size <= block.size) {
+      void* p = block.data + offset_;
+      offset_ += size;
+      return p;
+    }
+    ++current_;
+    offset_ = 0;
+  }
+
+  // operator new[] returns memory aligned for any fundamental type
+  Block block;
+  block.size = std::max(size, block_size_);
+  block.data = new char[block.size];
+  blocks_.push_back(block);
+  offset_ = size;
+  return block.data;
+}
+
+void Arena::Reset()
+{
+  current_ = 0;
+  offset_ = 0;
+}
+
+size_t Arena::Capacity() const
+{
+  size_t capacity = 0;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    capacity += blocks_[i].size;
+  }
+  return capacity;
+}
+
+}
+
@@ -0,0 +1,107 @@
+/*
+ * Poly2Tri Copyright (c) 2009-2010, Poly2Tri Contributors
+ * http://code.google.com/p/poly2tri/
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * * Neither the name of Poly2Tri nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without specific
+ *   prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace p2t {
+
+/**
+ * Bump allocator for the objects created during a triangulation (edges,
+ * nodes, triangles, advancing front). Memory is given back all at once by
+ * Reset(), blocks are kept, so an arena reused for many polygons stops
+ * allocating once it has grown to the size of the largest one.
+ */
+class Arena {
+public:
+
+    explicit Arena( size_t block_size = 64 * 1024 );
+
+    ~Arena();
+
+    /// Allocate size bytes, aligned for any fundamental type
+    void* Allocate( size_t size );
+
+    /// Release all allocations at once, objects must have been destroyed before
+    void Reset();
+
+    /// Bytes reserved by the blocks
+    size_t Capacity() const;
+
+private:
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t block_size_;
+    size_t current_;
+    size_t offset_;
+
+    // non copyable
+    Arena( const Arena& );
+    Arena& operator=( const Arena& );
+
+};
+
+/// Create an object in the arena, or on the heap if arena is NULL
+template< class T, class... Args >
+T* Create( Arena* arena, Args&&... args )
+{
+    if ( arena ) {
+        return new ( arena->Allocate( sizeof( T ) ) ) T( std::forward<Args>( args )... );
+    }
+
+    return new T( std::forward<Args>( args )... );
+}
+
+/// Destroy an object made by Create, its memory stays in the arena until Reset
+template< class T >
+void Destroy( Arena* arena, T* object )
+{
+    if ( !arena ) {
+        delete object;
+    }
+    else if ( object ) {
+        object->~T();
+    }
+}
+
+}
+
+#endif
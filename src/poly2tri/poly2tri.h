@@ -33,6 +33,7 @@
 #define POLY2TRI_H
 
 #include "common/shapes.h"
+#include "common/arena.h"
 #include "sweep/cdt.h"
 
 #endif
@@ -38,6 +38,12 @@ CDT::CDT(std::vector<Point*> polyline)
   sweep_ = new Sweep;
 }
 
+CDT::CDT(std::vector<Point*> polyline, Arena& arena)
+{
+  sweep_context_ = new SweepContext(polyline, &arena);
+  sweep_ = new Sweep(&arena);
+}
+
 void CDT::AddHole(std::vector<Point*> polyline)
 {
   sweep_context_->AddHole(polyline);
@@ -35,6 +35,7 @@
 #include "advancing_front.h"
 #include "sweep_context.h"
 #include "sweep.h"
+#include "../common/arena.h"
 
 /**
  *
@@ -54,6 +55,15 @@ public:
      */
     CDT( std::vector<Point*> polyline );
 
+    /**
+     * Constructor - the triangulation structures are allocated in arena,
+     * which must outlive this object, it can be Reset() once this is destroyed
+     *
+     * @param polyline
+     * @param arena
+     */
+    CDT( std::vector<Point*> polyline, Arena& arena );
+
     /**
     * Destructor - clean up memory
     */
@@ -33,9 +33,14 @@
 #include "sweep_context.h"
 #include "advancing_front.h"
 #include "../common/utils.h"
+#include "../common/arena.h"
 
 namespace p2t {
 
+Sweep::Sweep(Arena* arena) : arena_(arena)
+{
+}
+
 // Triangulate simple polygon with holes
 void Sweep::Triangulate(SweepContext& tcx)
 {
@@ -176,12 +181,12 @@ bool Sweep::IsEdgeSideOfTriangle(Triangle& triangle, Point& ep, Point& eq)
 
 Node& Sweep::NewFrontTriangle(SweepContext& tcx, Point& point, Node& node)
 {
-  Triangle* triangle = new Triangle(point, *node.point, *node.next->point);
+  Triangle* triangle = Create<Triangle>(tcx.arena(), point, *node.point, *node.next->point);
 
   triangle->MarkNeighbor(*node.triangle);
   tcx.AddToMap(triangle);
 
-  Node* new_node = new Node(point);
+  Node* new_node = Create<Node>(arena_, point);
   nodes_.push_back(new_node);
 
   new_node->next = node.next;
@@ -198,7 +203,7 @@ Node& Sweep::NewFrontTriangle(SweepContext& tcx, Point& point, Node& node)
 
 void Sweep::Fill(SweepContext& tcx, Node& node)
 {
-  Triangle* triangle = new Triangle(*node.prev->point, *node.point, *node.next->point);
+  Triangle* triangle = Create<Triangle>(tcx.arena(), *node.prev->point, *node.point, *node.next->point);
 
   // TODO: should copy the constrained_edge value from neighbor triangles
   //       for now constrained_edge values are copied during the legalize
@@ -809,7 +814,7 @@ Sweep::~Sweep() {
 
     // Clean up memory
     for(size_t i = 0; i < nodes_.size(); i++) {
-        delete nodes_[i];
+        Destroy(arena_, nodes_[i]);
     }
 
 }
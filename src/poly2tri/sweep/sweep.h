@@ -48,10 +48,18 @@ struct Node;
 struct Point;
 struct Edge;
 class Triangle;
+class Arena;
 
 class Sweep {
 public:
 
+    /**
+     * Constructor
+     *
+     * @param arena where nodes are allocated, NULL for the heap
+     */
+    explicit Sweep( Arena* arena = NULL );
+
     /**
      * Triangulate
      *
@@ -277,6 +285,8 @@ private:
 
     std::vector<Node*> nodes_;
 
+    Arena* arena_;
+
 };
 
 }
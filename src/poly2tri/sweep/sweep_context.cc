@@ -31,16 +31,18 @@
 #include "sweep_context.h"
 #include <algorithm>
 #include "advancing_front.h"
+#include "../common/arena.h"
 
 namespace p2t {
 
-SweepContext::SweepContext(std::vector<Point*> polyline) :
+SweepContext::SweepContext(std::vector<Point*> polyline, Arena* arena) :
   front_(0),
   head_(0),
   tail_(0),
   af_head_(0),
   af_middle_(0),
-  af_tail_(0)
+  af_tail_(0),
+  arena_(arena)
 {
   basin = Basin();
   edge_event = EdgeEvent();
@@ -69,7 +71,7 @@ std::vector<Triangle*> SweepContext::GetTriangles()
 
 std::list<Triangle*> SweepContext::GetMap()
 {
-  return map_;
+  return std::list<Triangle*>(map_.begin(), map_.end());
 }
 
 void SweepContext::InitTriangulation()
@@ -92,8 +94,8 @@ void SweepContext::InitTriangulation()
 
   double dx = kAlpha * (xmax - xmin);
   double dy = kAlpha * (ymax - ymin);
-  head_ = new Point(xmax + dx, ymin - dy);
-  tail_ = new Point(xmin - dx, ymin - dy);
+  head_ = Create<Point>(arena_, xmax + dx, ymin - dy);
+  tail_ = Create<Point>(arena_, xmin - dx, ymin - dy);
 
   // Sort points along y-axis
   std::sort(points_.begin(), points_.end(), cmp);
@@ -103,9 +105,10 @@ void SweepContext::InitTriangulation()
 void SweepContext::InitEdges(std::vector<Point*> polyline)
 {
   int num_points = polyline.size();
+  edge_list.reserve(edge_list.size() + num_points);
   for (int i = 0; i < num_points; i++) {
     int j = i < num_points - 1 ? i + 1 : 0;
-    edge_list.push_back(new Edge(*polyline[i], *polyline[j]));
+    edge_list.push_back(Create<Edge>(arena_, *polyline[i], *polyline[j]));
   }
 }
 
@@ -130,14 +133,14 @@ void SweepContext::CreateAdvancingFront(std::vector<Node*> nodes)
 
   (void) nodes;
   // Initial triangle
-  Triangle* triangle = new Triangle(*points_[0], *tail_, *head_);
+  Triangle* triangle = Create<Triangle>(arena_, *points_[0], *tail_, *head_);
 
   map_.push_back(triangle);
 
-  af_head_ = new Node(*triangle->GetPoint(1), *triangle);
-  af_middle_ = new Node(*triangle->GetPoint(0), *triangle);
-  af_tail_ = new Node(*triangle->GetPoint(2));
-  front_ = new AdvancingFront(*af_head_, *af_tail_);
+  af_head_ = Create<Node>(arena_, *triangle->GetPoint(1), *triangle);
+  af_middle_ = Create<Node>(arena_, *triangle->GetPoint(0), *triangle);
+  af_tail_ = Create<Node>(arena_, *triangle->GetPoint(2));
+  front_ = Create<AdvancingFront>(arena_, *af_head_, *af_tail_);
 
   // TODO: More intuitive if head is middles next and not previous?
   //       so swap head and tail
@@ -149,7 +152,7 @@ void SweepContext::CreateAdvancingFront(std::vector<Node*> nodes)
 
 void SweepContext::RemoveNode(Node* node)
 {
-  delete node;
+  Destroy(arena_, node);
 }
 
 void SweepContext::MapTriangleToNodes(Triangle& t)
@@ -165,7 +168,7 @@ void SweepContext::MapTriangleToNodes(Triangle& t)
 
 void SweepContext::RemoveFromMap(Triangle* triangle)
 {
-  map_.remove(triangle);
+  map_.erase(std::remove(map_.begin(), map_.end(), triangle), map_.end());
 }
 
 void SweepContext::MeshClean(Triangle& triangle)
@@ -191,24 +194,21 @@ void SweepContext::MeshClean(Triangle& triangle)
 SweepContext::~SweepContext()
 {
 
-    // Clean up memory
+    // Clean up memory, with an arena only the destructors are run
 
-    delete head_;
-    delete tail_;
-    delete front_;
-    delete af_head_;
-    delete af_middle_;
-    delete af_tail_;
+    Destroy(arena_, head_);
+    Destroy(arena_, tail_);
+    Destroy(arena_, front_);
+    Destroy(arena_, af_head_);
+    Destroy(arena_, af_middle_);
+    Destroy(arena_, af_tail_);
 
-    typedef std::list<Triangle*> type_list;
-
-    for(type_list::iterator iter = map_.begin(); iter != map_.end(); ++iter) {
-        Triangle* ptr = *iter;
-        delete ptr;
+    for(unsigned int i = 0; i < map_.size(); i++) {
+        Destroy(arena_, map_[i]);
     }
 
      for(unsigned int i = 0; i < edge_list.size(); i++) {
-        delete edge_list[i];
+        Destroy(arena_, edge_list[i]);
     }
 
 }
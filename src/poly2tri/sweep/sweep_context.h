@@ -44,6 +44,7 @@ const double kAlpha = 0.3;
 
 struct Point;
 class Triangle;
+class Arena;
 struct Node;
 struct Edge;
 class AdvancingFront;
@@ -51,8 +52,8 @@ class AdvancingFront;
 class SweepContext {
 public:
 
-/// Constructor
-    SweepContext( std::vector<Point*> polyline );
+/// Constructor, the triangulation structures are allocated in arena if not NULL
+    SweepContext( std::vector<Point*> polyline, Arena* arena = NULL );
 /// Destructor
     ~SweepContext();
 
@@ -89,6 +90,8 @@ public:
 
     AdvancingFront* front();
 
+    Arena* arena();
+
     void MeshClean( Triangle& triangle );
 
     std::vector<Triangle*> GetTriangles();
@@ -131,7 +134,7 @@ private:
     friend class Sweep;
 
     std::vector<Triangle*> triangles_;
-    std::list<Triangle*> map_;
+    std::vector<Triangle*> map_;
     std::vector<Point*> points_;
 
 // Advancing front
@@ -143,6 +146,9 @@ private:
 
     Node* af_head_, *af_middle_, *af_tail_;
 
+// may be NULL, then the heap is used
+    Arena* arena_;
+
     void InitTriangulation();
     void InitEdges( std::vector<Point*> polyline );
 
@@ -153,6 +159,11 @@ inline AdvancingFront* SweepContext::front()
     return front_;
 }
 
+inline Arena* SweepContext::arena()
+{
+    return arena_;
+}
+
 inline int SweepContext::point_count()
 {
     return points_.size();
@@ -19,10 +19,15 @@
 #include "Interpreter.h"
 
 #include <osgGIS/StringUtils.h>
+#include <osgGIS/PostgisConnection.h>
 #include "SkyBox.h"
 
 #include <osgDB/ReadFile>
 #include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/Options>
+#include <osg/PagedLOD>
+#include <osgUtil/CullVisitor>
 #include <osg/Material>
 #include <osg/Geode>
 #include <osg/ShapeDrawable>
@@ -30,6 +35,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <cfloat>
 #include <cassert>
 
 #define POSTGIS_EXTENSION ".postgis"
@@ -105,6 +111,8 @@ void Interpreter::run()
         COMMAND( lookAt )
         COMMAND( addSky )
         COMMAND( writeFile )
+        COMMAND( printStats )
+        COMMAND( setPager )
         else {
             const std::string msg = "unknown command '" + cmd + "'";
             std::cout << "<error msg=\"" << escapeXMLString( msg ) << "\"/>\n";
@@ -129,6 +137,29 @@ void Interpreter::writeFile( const AttributeMap& am )
     _viewer->writeFile( am.value( "file" ) );
 }
 
+void Interpreter::printStats( const AttributeMap& )
+{
+    double frameRate, cull, draw;
+    _viewer->frameStats( frameRate, cull, draw );
+    std::cout << "<stats frame_rate=\"" << frameRate << "\" cull_ms=\"" << cull*1000
+              << "\" draw_ms=\"" << draw*1000 << "\"/>\n";
+}
+
+void Interpreter::setPager( const AttributeMap& am )
+{
+    const char* const names[4] = { "threads", "http_threads", "max_pagedlod", "target_frame_rate" };
+    double values[4] = { -1, -1, -1, -1 };
+
+    for ( size_t i = 0; i < 4; i++ ) {
+        if ( !am.optionalValue( names[i] ).empty()
+                && ( !( std::stringstream( am.optionalValue( names[i] ) ) >> values[i] ) || values[i] < 0 ) ) {
+            throw std::runtime_error( std::string( "cannot parse " ) + names[i] );
+        }
+    }
+
+    _viewer->setPager( int( values[0] ), int( values[1] ), int( values[2] ), values[3] );
+}
+
 void Interpreter::lookAt( const AttributeMap& am )
 {
     if ( am.optionalValue( "extent" ).empty() ) {
@@ -244,88 +275,455 @@ void Interpreter::addPlane( const AttributeMap& am )
     _viewer->addNode( am.value( "id" ), geode );
 }
 
-void Interpreter::loadVectorPostgis( const AttributeMap& am )
+// optional layer attributes that are passed to the postgis plugin
+const char* const POSTGIS_OPTIONS[] = {
+    "elevation",
+    "elevation_sampling",
+    "streaming",
+    "pool_size",
+    "pool_idle_timeout",
+    "threads",
+    "weld",
+    "triangulator",
+    "full_check",
+    "bars",
+    "vertex_format",
+    "cache_dir",
+    "cache_size"
+};
+
+//! @return the space separated list of key="value" for attributes that are defined
+template< size_t N >
+const std::string optionalAttributes( const AttributeMap& am, const char* const ( &names )[N] )
 {
-    std::string geocolumn = "geom";
+    std::string attributes;
 
-    if ( ! am.optionalValue( "geocolumn" ).empty() ) {
-        geocolumn = am.optionalValue( "geocolumn" );
+    for ( size_t i = 0; i < N; i++ ) {
+        if ( !am.optionalValue( names[i] ).empty() ) {
+            attributes += std::string( " " ) + names[i] + "=\"" + escapeXMLString( am.optionalValue( names[i] ) ) + "\"";
+        }
     }
 
-    // with LOD
-    if ( ! am.optionalValue( "lod" ).empty() ) {
-        std::vector<  double > lodDistance;
-        std::stringstream levels( am.optionalValue( "lod" ) );
-        std::string l;
+    return attributes;
+}
 
-        while ( std::getline( levels, l, ' ' ) ) {
-            lodDistance.push_back( atof( l.c_str() ) );
-            const int idx = lodDistance.size()-2;
+//! raises the loading priority of tiles near the center of the view, on top of the layer
+//! priority, the pager already favors the closest tiles within a level
+//! @note requests are renewed at each cull, those of tiles that went out of view are
+//!       dropped by the pager, so the priority follows the camera
+struct ViewCenterPriority: osg::NodeCallback {
+    ViewCenterPriority( float priority ): _priority( priority ) {}
+
+    void operator()( osg::Node* node, osg::NodeVisitor* nv ) {
+        osgUtil::CullVisitor* cv = dynamic_cast< osgUtil::CullVisitor* >( nv );
+
+        if ( cv ) {
+            osg::PagedLOD* pagedLod = static_cast< osg::PagedLOD* >( node );
+            const osg::BoundingSphere& bound = pagedLod->getBound();
+            const osg::Vec3 center = bound.center() * ( *cv->getModelViewMatrix() );
+            // 1 in the view axis, decreasing with the tangent of the angle to it
+            const float depth = std::max( -center.z(), bound.radius() );
+            const float offset = _priority + 1.f/( 1.f + osg::Vec2( center.x(), center.y() ).length()/depth );
+
+            for ( unsigned i = 0; i < pagedLod->getNumPriorityOffsets(); i++ ) {
+                pagedLod->setPriorityOffset( i, offset );
+            }
+        }
 
-            if ( idx < 0 ) {
-                continue;
+        traverse( node, nv );
+    }
+
+private:
+    const float _priority;
+};
+
+//! tiles of a layer organized in a quadtree: the cull traversal skips the tiles of a
+//! node out of view at once instead of visiting each of them, nodes are PagedLODs whose
+//! children are created by the database pager through this callback, when the node
+//! is closer than the farthest lod distance (or large enough on screen for geometric errors)
+struct QuadTree: osgDB::ReadFileCallback {
+    //! @param am layer attributes extent, tile_size, origin and optional depth: number of
+    //!        levels above the nodes containing tiles, 0 for a flat grid of tiles, by default
+    //!        these nodes contain at most 8x8 tiles
+    //!        with geometric_error, the levels are selected by their error on screen, in
+    //!        pixels, that must stay below target_error (2 by default), the optional
+    //!        priority is added to the loading priority of the tiles of the layer
+    //! @param lod limits of the levels of detail, one more than the number of levels: camera
+    //!        distances, decreasing, or with geometric_error the error of displaying nothing
+    //!        followed by the errors of the levels, in layer units, decreasing
+    //! @param tileFiles pseudo files of the levels of detail of a tile, the
+    //!        tile extent replaces {xmin}, {ymin}, {xmax} and {ymax}
+    QuadTree( const AttributeMap& am, const std::vector< double >& lod,
+              const std::vector< std::string >& tileFiles )
+        : _lod( lod )
+        , _tileFiles( tileFiles )
+        , _targetError( 0 )
+        , _tileFeatures( 0 )
+    {
+        float priority = 0;
+
+        if ( !( std::stringstream( am.optionalValue( "priority" ).empty() ? "0" : am.optionalValue( "priority" ) ) >> priority ) ) {
+            throw std::runtime_error( "cannot parse priority" );
+        }
+
+        _priority = new ViewCenterPriority( priority );
+
+        if ( !am.optionalValue( "geometric_error" ).empty() ) {
+            _targetError = 2;
+
+            if ( !am.optionalValue( "target_error" ).empty()
+                    && ( !( std::stringstream( am.optionalValue( "target_error" ) ) >> _targetError ) || _targetError <= 0 ) ) {
+                throw std::runtime_error( "cannot parse target_error" );
             }
 
-            const std::string lodIdx = intToString( idx );
+            if ( _lod.size() < 2 || _lod[0] <= 0 ) {
+                throw std::runtime_error( "geometric_error needs a positive error for no display followed by the errors of the levels" );
+            }
         }
 
-        float xmin, ymin, xmax, ymax;
         std::stringstream ext( am.value( "extent" ) );
+        std::string l;
 
-        if ( !( ext >> xmin >> ymin )
+        if ( !( ext >> _xmin >> _ymin )
                 || !std::getline( ext, l, ',' )
-                || !( ext >> xmax >> ymax ) ) {
+                || !( ext >> _xmax >> _ymax ) ) {
             throw std::runtime_error( "cannot parse extent" );
         }
 
-        float tileSize;
-
-        if ( !( std::stringstream( am.value( "tile_size" ) ) >> tileSize ) || tileSize <= 0 ) {
+        if ( !( std::stringstream( am.value( "tile_size" ) ) >> _tileSize ) || _tileSize <= 0 ) {
             throw std::runtime_error( "cannot parse tile_size" );
         }
 
-        osg::Vec3 origin( 0,0,0 );
-
-        if ( !( std::stringstream( am.value( "origin" ) ) >> origin.x() >> origin.y() ) ) {
+        if ( !( std::stringstream( am.value( "origin" ) ) >> _origin.x() >> _origin.y() ) ) {
             throw std::runtime_error( "cannot parse origin" );
         }
 
+        _numTilesX = ( _xmax-_xmin )/_tileSize + 1;
+        _numTilesY = ( _ymax-_ymin )/_tileSize + 1;
+        const size_t numTiles = std::max( _numTilesX, _numTilesY );
+
+        _depth = 0;
+
+        if ( !am.optionalValue( "depth" ).empty() ) {
+            if ( !( std::stringstream( am.optionalValue( "depth" ) ) >> _depth ) || _depth < 0 || _depth > 16 ) {
+                throw std::runtime_error( "cannot parse depth" );
+            }
+        }
+        else {
+            while ( ( ( numTiles - 1 ) >> _depth ) + 1 > 8 ) {
+                ++_depth;
+            }
+        }
+
+        _leafTiles = ( ( numTiles - 1 ) >> _depth ) + 1;
+    }
+
+    //! counts the features of each tile with a pre-pass on the server, tiles without
+    //! features are then not created, dense tiles are split and leaf nodes with few
+    //! features are merged into a single tile
+    //! @param queries the queries of the levels of detail, with spatial meta comment
+    //! @param tileFeatures number of features above which a tile is split, and below
+    //!        which the tiles of a leaf node are merged
+    void countFeatures( const std::string& connInfo, const std::vector< std::string >& queries,
+                        const std::string& geocolumn, size_t tileFeatures ) {
+        osgGIS::PostgisConnection conn( connInfo );
+
+        if ( !conn ) {
+            throw std::runtime_error( "cannot connect to '" + connInfo + "' for density pre-pass" );
+        }
+
+        // bars layers have a pos column instead of the geometry, the columns are
+        // those of the query on an empty tile
+        std::string column = geocolumn;
+        {
+            osgGIS::PostgisConnection::QueryResult columns( conn, "SELECT * FROM (" + tileQuery( queries[0], 0, 0, 0, 0 ) + ") AS l LIMIT 0" );
+
+            if ( !columns ) {
+                throw std::runtime_error( "density pre-pass failed: " + columns.error() );
+            }
+
+            if ( PQfnumber( columns.get(), geocolumn.c_str() ) < 0 && PQfnumber( columns.get(), "pos" ) >= 0 ) {
+                column = "pos";
+            }
+        }
+
+        osgGIS::PostgisConnection::QueryResult res( conn,
+                densityQuery( queries, column, _xmin, _ymin, _xmax, _ymax, _tileSize ) );
 
-        const size_t numTilesX = ( xmax-xmin )/tileSize + 1;
+        if ( !res ) {
+            throw std::runtime_error( "density pre-pass failed: " + res.error() );
+        }
+
+        // summed area table, the count of any block of tiles is then obtained in constant time
+        // centroids out of the extent belong to features that intersect the border tiles
+        std::vector< unsigned long long > count( _numTilesX*_numTilesY, 0 );
 
-        const size_t numTilesY = ( ymax-ymin )/tileSize + 1;
+        for ( int i = 0; i < PQntuples( res.get() ); i++ ) {
+            const long ix = atol( PQgetvalue( res.get(), i, 0 ) );
+            const long iy = atol( PQgetvalue( res.get(), i, 1 ) );
+            const size_t tx = std::min( size_t( std::max( ix, 0L ) ), _numTilesX-1 );
+            const size_t ty = std::min( size_t( std::max( iy, 0L ) ), _numTilesY-1 );
+            count[ tx + ty*_numTilesX ] += atoll( PQgetvalue( res.get(), i, 2 ) );
+        }
+
+        _density.assign( ( _numTilesX+1 )*( _numTilesY+1 ), 0 );
+
+        for ( size_t ty = 0; ty < _numTilesY; ty++ ) {
+            for ( size_t tx = 0; tx < _numTilesX; tx++ ) {
+                _density[ tx+1 + ( ty+1 )*( _numTilesX+1 ) ] = count[ tx + ty*_numTilesX ]
+                        + _density[ tx + ( ty+1 )*( _numTilesX+1 ) ]
+                        + _density[ tx+1 + ty*( _numTilesX+1 ) ]
+                        - _density[ tx + ty*( _numTilesX+1 ) ];
+            }
+        }
+
+        _tileFeatures = std::max( tileFeatures, size_t( 1 ) );
+    }
+
+    //! @return the root of the quadtree, its children are paged in by the database pager
+    osg::Node* createRoot() {
+        osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+        options->setReadFileCallback( this );
+        return createNode( 0, 0, 0, options.get() );
+    }
+
+    //! file names are "level ix iy.quadtree", other files are read normally
+    osgDB::ReaderWriter::ReadResult readNode( const std::string& file, const osgDB::Options* options ) {
+        int level;
+        size_t ix, iy;
+
+        if ( osgDB::getLowerCaseFileExtension( file ) != "quadtree" ) {
+            return osgDB::ReadFileCallback::readNode( file, options );
+        }
 
+        if ( !( std::stringstream( file ) >> level >> ix >> iy ) || level <= 0 || level > _depth ) {
+            return osgDB::ReaderWriter::ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        // the children load with the options of their parent, i.e. with this callback
+        return createNode( level, ix, iy, const_cast< osgDB::Options* >( options ) );
+    }
+
+private:
+    const std::vector< double > _lod; // distances, or geometric errors if _targetError > 0
+    const std::vector< std::string > _tileFiles;
+    double _targetError; // in pixels, 0 for lod distances
+    osg::ref_ptr< ViewCenterPriority > _priority; // cull callback of all PagedLODs
+    osg::Vec3 _origin;
+    double _xmin, _ymin, _xmax, _ymax;
+    double _tileSize;
+    size_t _numTilesX, _numTilesY;
+    int _depth;
+    size_t _leafTiles; // tiles per side of the nodes at depth
+    std::vector< unsigned long long > _density; // summed area table of feature counts, empty without pre-pass
+    size_t _tileFeatures;
+
+    //! number of features of tiles [x0, x1[ x [y0, y1[, 1 without pre-pass
+    unsigned long long numFeatures( size_t x0, size_t y0, size_t x1, size_t y1 ) const {
+        if ( _density.empty() ) {
+            return 1;
+        }
+
+        const size_t w = _numTilesX+1;
+        return _density[ x1 + y1*w ] - _density[ x0 + y1*w ] - _density[ x1 + y0*w ] + _density[ x0 + y0*w ];
+    }
+
+    //! node of the tiles of cell (ix, iy) of level (0 is the root, _depth contains tiles)
+    osg::Node* createNode( int level, size_t ix, size_t iy, osgDB::Options* options ) const {
+        const size_t cell = _leafTiles << ( _depth - level );
         osg::ref_ptr<osg::Group> group = new osg::Group;
 
-        for ( size_t ix=0; ix<numTilesX; ix++ ) {
-            for ( size_t iy=0; iy<numTilesY; iy++ ) {
+        if ( level == _depth ) {
+            const size_t x0 = ix*cell;
+            const size_t y0 = iy*cell;
+            const size_t x1 = std::min( ( ix+1 )*cell, _numTilesX );
+            const size_t y1 = std::min( ( iy+1 )*cell, _numTilesY );
+
+            // sparse node, a single tile
+            if ( !_density.empty() && numFeatures( x0, y0, x1, y1 ) <= _tileFeatures ) {
+                if ( numFeatures( x0, y0, x1, y1 ) ) {
+                    group->addChild( createTile( _xmin + x0*_tileSize, _ymin + y0*_tileSize,
+                                                 ( x1-x0 )*_tileSize, ( y1-y0 )*_tileSize ) );
+                }
+
+                return group.release();
+            }
+
+            for ( size_t tx = x0; tx < x1; tx++ ) {
+                for ( size_t ty = y0; ty < y1; ty++ ) {
+                    const unsigned long long n = numFeatures( tx, ty, tx+1, ty+1 );
+
+                    if ( !n ) {
+                        continue;
+                    }
+
+                    // dense tile, split in k x k
+                    const size_t k = _density.empty() ? 1 : std::min( size_t( std::ceil( std::sqrt( double( n )/_tileFeatures ) ) ), size_t( 4 ) );
+                    const double size = _tileSize/k;
+
+                    for ( size_t sx = 0; sx < k; sx++ ) {
+                        for ( size_t sy = 0; sy < k; sy++ ) {
+                            group->addChild( createTile( _xmin + tx*_tileSize + sx*size, _ymin + ty*_tileSize + sy*size, size, size ) );
+                        }
+                    }
+                }
+            }
+
+            return group.release();
+        }
+
+        const size_t half = cell/2;
+
+        for ( size_t cx = 2*ix; cx < 2*ix+2 && cx*half < _numTilesX; cx++ ) {
+            for ( size_t cy = 2*iy; cy < 2*iy+2 && cy*half < _numTilesY; cy++ ) {
+                if ( !numFeatures( cx*half, cy*half, std::min( ( cx+1 )*half, _numTilesX ), std::min( ( cy+1 )*half, _numTilesY ) ) ) {
+                    continue;
+                }
+
+                // bound of the tiles, the last ones do not fill the cell
+                const osg::Vec3 lower( _xmin + cx*half*_tileSize, _ymin + cy*half*_tileSize, 0 );
+                const osg::Vec3 upper( _xmin + std::min( ( cx+1 )*half, _numTilesX )*_tileSize,
+                                       _ymin + std::min( ( cy+1 )*half, _numTilesY )*_tileSize, 0 );
+                const float radius = .5*( upper - lower ).length();
+
                 osg::ref_ptr<osg::PagedLOD> pagedLod = new osg::PagedLOD;
-                const float xm = xmin + ix*tileSize;
-                const float ym = ymin + iy*tileSize;
-
-                for ( size_t ilod = 0; ilod < lodDistance.size()-1; ilod++ ) {
-                    const std::string lodIdx = intToString( ilod );
-                    const std::string query = tileQuery( am.value( "query_"+lodIdx ), xm, ym, xm+tileSize, ym+tileSize );
-                    const std::string pseudoFile = "conn_info=\"" + escapeXMLString( am.value( "conn_info" ) )       + "\" "
-                                                   + "origin=\""    + escapeXMLString( am.value( "origin" ) )          + "\" "
-                                                   + "geocolumn=\"" + geocolumn + "\" "
-                                                   + "query=\""     + escapeXMLString( query ) + "\""
-                                                   + ( am.optionalValue( "elevation" ).empty() ? "" : "elevation=\"" +  escapeXMLString( am.optionalValue( "elevation" ) ) + "\"" )
-                                                   + POSTGIS_EXTENSION;
-
-                    pagedLod->setFileName( ilod,  pseudoFile );
-                    pagedLod->setRange( ilod, lodDistance[ilod+1], lodDistance[ilod] );
+                pagedLod->setFileName( 0, intToString( level+1 ) + " " + intToString( cx ) + " " + intToString( cy ) + ".quadtree" );
+
+                if ( _targetError > 0 ) {
+                    // tiles are displayed closer than D = k*_lod[0]/_targetError, for k the pixels per unit
+                    // at unit distance, the node's pixel size is then above 2*radius*k/(D+radius), which is
+                    // above half the one of a tile at distance D when the node is larger than the tile
+                    // and D is larger than the tile
+                    pagedLod->setRangeMode( osg::LOD::PIXEL_SIZE_ON_SCREEN );
+                    pagedLod->setRange( 0, .5*_targetError*_tileSize*std::sqrt( 2.0 )/_lod[0], FLT_MAX );
+                }
+                else {
+                    pagedLod->setRange( 0, 0, _lod[0] + radius );
                 }
 
-                pagedLod->setCenter( osg::Vec3( xm+.5*tileSize, ym+.5*tileSize ,0 ) - origin );
-                pagedLod->setRadius( .5*tileSize*std::sqrt( 2.0 ) );
+                pagedLod->setDatabaseOptions( options );
+                pagedLod->setCullCallback( _priority.get() );
+                pagedLod->setCenter( ( lower + upper )*.5 - _origin );
+                pagedLod->setRadius( radius );
                 group->addChild( pagedLod.get() );
             }
         }
 
-        _viewer->addNode( am.value( "id" ), group.get() );
+        return group.release();
+    }
+
+    //! tile of extent [xm, xm+width] x [ym, ym+height], the lod distances are for tiles
+    //! of tile_size and are shifted by the difference of radius for other sizes, the
+    //! pixel sizes of geometric errors scale with the radius
+    osg::Node* createTile( double xm, double ym, double width, double height ) const {
+        const double extent[4] = { xm, ym, xm+width, ym+height };
+        const char* const names[4] = { "{xmin}", "{ymin}", "{xmax}", "{ymax}" };
+        const double radius = .5*std::sqrt( width*width + height*height );
+        const double shift = radius - .5*_tileSize*std::sqrt( 2.0 );
+
+        osg::ref_ptr<osg::PagedLOD> pagedLod = new osg::PagedLOD;
 
+        for ( size_t ilod = 0; ilod < _tileFiles.size(); ilod++ ) {
+            std::string pseudoFile( _tileFiles[ilod] );
 
+            for ( size_t i = 0; i < 4; i++ ) {
+                std::stringstream value;
+                value << std::setprecision( 16 ) << extent[i];
+                boost::replace_all( pseudoFile, names[i], value.str() );
+            }
+
+            pagedLod->setFileName( ilod,  pseudoFile );
+
+            if ( _targetError > 0 ) {
+                // the pixel size of the tile is its projected diameter, the error e of a level is
+                // then e*pixelSize/(2*radius) pixels on screen, the level is displayed when the
+                // error of the previous one is above target and its own error is below
+                pagedLod->setRange( ilod, _targetError*2*radius/_lod[ilod],
+                                    _lod[ilod+1] > 0 ? _targetError*2*radius/_lod[ilod+1] : FLT_MAX );
+            }
+            else {
+                pagedLod->setRange( ilod, _lod[ilod+1] > 0 ? std::max( _lod[ilod+1] + shift, 0.0 ) : 0,
+                                    std::max( _lod[ilod] + shift, 0.0 ) );
+            }
+        }
+
+        if ( _targetError > 0 ) {
+            pagedLod->setRangeMode( osg::LOD::PIXEL_SIZE_ON_SCREEN );
+        }
+
+        pagedLod->setCenter( osg::Vec3( xm+.5*width, ym+.5*height ,0 ) - _origin );
+        pagedLod->setRadius( radius );
+        pagedLod->setCullCallback( _priority.get() );
+        return pagedLod.release();
+    }
+};
+
+void Interpreter::loadVectorPostgis( const AttributeMap& am )
+{
+    std::string geocolumn = "geom";
+
+    if ( ! am.optionalValue( "geocolumn" ).empty() ) {
+        geocolumn = am.optionalValue( "geocolumn" );
+    }
+
+    // with LOD, selected by camera distance or by geometric error on screen
+    if ( ! am.optionalValue( "lod" ).empty() || ! am.optionalValue( "geometric_error" ).empty() ) {
+        std::vector<  double > lod;
+        std::stringstream levels( am.optionalValue( am.optionalValue( "geometric_error" ).empty() ? "lod" : "geometric_error" ) );
+        std::string l;
+
+        while ( std::getline( levels, l, ' ' ) ) {
+            lod.push_back( atof( l.c_str() ) );
+            const int idx = lod.size()-2;
+
+            if ( idx < 0 ) {
+                continue;
+            }
+
+            const std::string lodIdx = intToString( idx );
+        }
+
+        // the same query is used for all tiles of a level, with the tile bbox as parameters
+        std::vector< std::string > queries;
+
+        for ( size_t ilod = 0; ilod < lod.size()-1; ilod++ ) {
+            queries.push_back( preparedTileQuery( am.value( "query_"+intToString( ilod ) ) ) );
+        }
+
+        std::vector< std::string > tileFiles;
+
+        for ( size_t ilod = 0; ilod < lod.size()-1; ilod++ ) {
+            // tile bbox are the parameters of the prepared query
+            tileFiles.push_back( "conn_info=\"" + escapeXMLString( am.value( "conn_info" ) )       + "\" "
+                                 + "origin=\""    + escapeXMLString( am.value( "origin" ) )          + "\" "
+                                 + "geocolumn=\"" + geocolumn + "\" "
+                                 + "query=\""     + escapeXMLString( queries[ilod] ) + "\" "
+                                 + "tile=\"{xmin} {ymin} {xmax} {ymax}\""
+                                 + optionalAttributes( am, POSTGIS_OPTIONS )
+                                 + POSTGIS_EXTENSION );
+        }
+
+        osg::ref_ptr<QuadTree> quadTree = new QuadTree( am, lod, tileFiles );
+
+        // optional pre-pass to skip empty tiles and adapt tile size to density
+        if ( !am.optionalValue( "tile_features" ).empty() ) {
+            size_t tileFeatures;
+
+            if ( !( std::stringstream( am.optionalValue( "tile_features" ) ) >> tileFeatures ) ) {
+                throw std::runtime_error( "cannot parse tile_features" );
+            }
+
+            std::vector< std::string > levelQueries;
+
+            for ( size_t ilod = 0; ilod < lod.size()-1; ilod++ ) {
+                levelQueries.push_back( am.value( "query_"+intToString( ilod ) ) );
+            }
+
+            quadTree->countFeatures( am.value( "conn_info" ), levelQueries, geocolumn, tileFeatures );
+        }
+
+        osg::ref_ptr<osg::Node> root = quadTree->createRoot();
+        _viewer->addNode( am.value( "id" ), root.get() );
     }
     // without LOD
     else {
@@ -333,7 +731,7 @@ void Interpreter::loadVectorPostgis( const AttributeMap& am )
                                        + "origin=\""          + escapeXMLString( am.value( "origin" ) )          + "\" "
                                        + "geocolumn=\"" + escapeXMLString( geocolumn ) + "\" "
                                        + "query=\""           + escapeXMLString( am.value( "query" ) )           + "\""
-                                       + ( am.optionalValue( "elevation" ).empty() ? "" : "elevation=\"" +  escapeXMLString( am.optionalValue( "elevation" ) ) + "\"" )
+                                       + optionalAttributes( am, POSTGIS_OPTIONS )
                                        + POSTGIS_EXTENSION;
         osg::ref_ptr<osg::Node> node = osgDB::readNodeFile( pseudoFile );
 
@@ -368,15 +766,15 @@ void Interpreter::loadElevation( const AttributeMap& am )
         return;
     }
 
-    // with LOD
-    if ( ! am.optionalValue( "lod" ).empty() ) {
-        std::vector<  double > lodDistance;
-        std::stringstream levels( am.optionalValue( "lod" ) );
+    // with LOD, selected by camera distance or by geometric error on screen
+    if ( ! am.optionalValue( "lod" ).empty() || ! am.optionalValue( "geometric_error" ).empty() ) {
+        std::vector<  double > lod;
+        std::stringstream levels( am.optionalValue( am.optionalValue( "geometric_error" ).empty() ? "lod" : "geometric_error" ) );
         std::string l;
 
         while ( std::getline( levels, l, ' ' ) ) {
-            lodDistance.push_back( atof( l.c_str() ) );
-            const int idx = lodDistance.size()-2;
+            lod.push_back( atof( l.c_str() ) );
+            const int idx = lod.size()-2;
 
             if ( idx < 0 ) {
                 continue;
@@ -385,61 +783,20 @@ void Interpreter::loadElevation( const AttributeMap& am )
             const std::string lodIdx = intToString( idx );
         }
 
-        float xmin, ymin, xmax, ymax;
-        std::stringstream ext( am.value( "extent" ) );
-
-        if ( !( ext >> xmin >> ymin )
-                || !std::getline( ext, l, ',' )
-                || !( ext >> xmax >> ymax ) ) {
-            throw std::runtime_error( "cannot parse extent" );
-        }
-
-        float tileSize;
-
-        if ( !( std::stringstream( am.value( "tile_size" ) ) >> tileSize ) || tileSize <= 0 ) {
-            throw std::runtime_error( "cannot parse tile_size" );
-        }
-
-        osg::Vec3 origin( 0,0,0 );
-
-        if ( !( std::stringstream( am.value( "origin" ) ) >> origin.x() >> origin.y() ) ) {
-            throw std::runtime_error( "cannot parse origin" );
-        }
-
-        const size_t numTilesX = ( xmax-xmin )/tileSize + 1;
+        std::vector< std::string > tileFiles;
 
-        const size_t numTilesY = ( ymax-ymin )/tileSize + 1;
-
-        osg::ref_ptr<osg::Group> group = new osg::Group;
-
-        for ( size_t ix=0; ix<numTilesX; ix++ ) {
-            for ( size_t iy=0; iy<numTilesY; iy++ ) {
-                osg::ref_ptr<osg::PagedLOD> pagedLod = new osg::PagedLOD;
-                const float xm = xmin + ix*tileSize;
-                const float ym = ymin + iy*tileSize;
-
-                for ( size_t ilod = 0; ilod < lodDistance.size()-1; ilod++ ) {
-                    const std::string lodIdx = intToString( ilod );
-                    std::stringstream extent;
-                    extent << std::setprecision( 16 )
-                           << xm << " " << ym << "," << xm+tileSize << " " << ym+tileSize;
-                    const std::string pseudoFile =
-                        "file=\""      + escapeXMLString( am.value( "file" ) )              + "\" "
-                        + "origin=\""    + escapeXMLString( am.value( "origin" ) )            + "\" "
-                        + "mesh_size=\"" + escapeXMLString( am.value( "mesh_size_"+lodIdx ) ) + "\" "
-                        + "extent=\""    + extent.str()                                   + "\" " + MNT_EXTENSION;
-
-                    pagedLod->setFileName( ilod,  pseudoFile );
-                    pagedLod->setRange( ilod, lodDistance[ilod+1], lodDistance[ilod] );
-                }
-
-                pagedLod->setCenter( osg::Vec3( xm+.5*tileSize, ym+.5*tileSize ,0 ) - origin );
-                pagedLod->setRadius( .5*tileSize*std::sqrt( 2.0 ) );
-                group->addChild( pagedLod.get() );
-            }
+        for ( size_t ilod = 0; ilod < lod.size()-1; ilod++ ) {
+            const std::string lodIdx = intToString( ilod );
+            tileFiles.push_back(
+                "file=\""      + escapeXMLString( am.value( "file" ) )              + "\" "
+                + "origin=\""    + escapeXMLString( am.value( "origin" ) )            + "\" "
+                + "mesh_size=\"" + escapeXMLString( am.value( "mesh_size_"+lodIdx ) ) + "\" "
+                + "extent=\"{xmin} {ymin},{xmax} {ymax}\" " + MNT_EXTENSION );
         }
 
-        _viewer->addNode( am.value( "id" ), group.get() );
+        osg::ref_ptr<QuadTree> quadTree = new QuadTree( am, lod, tileFiles );
+        osg::ref_ptr<osg::Node> root = quadTree->createRoot();
+        _viewer->addNode( am.value( "id" ), root.get() );
     }
     // without LOD
     else {
@@ -539,7 +896,9 @@ void Interpreter::setFullExtent( const AttributeMap& )
     throw std::runtime_error( "not implemented" );
 }
 
-const std::string tileQuery( std::string query, float xmin, float ymin, float xmax, float ymax )
+//! replace the spatial meta comment by the actual condition on tile bbox
+inline
+const std::string replaceTile( std::string query, const std::string& bbox )
 {
     const char* spacialMetaComments[] = {"/**WHERE TILE &&", "/**AND TILE &&"};
 
@@ -559,11 +918,9 @@ const std::string tileQuery( std::string query, float xmin, float ymin, float xm
 
             query.replace ( end, 2, "" );
 
-            std::stringstream bbox;
-            bbox << "ST_MakeEnvelope(" << xmin << "," << ymin << "," << xmax << "," << ymax << ")";
             const size_t tile = query.find( "TILE", where );
             assert( tile != std::string::npos );
-            query.replace( tile, 4, bbox.str().c_str() );
+            query.replace( tile, 4, bbox );
         }
     }
 
@@ -574,5 +931,38 @@ const std::string tileQuery( std::string query, float xmin, float ymin, float xm
     return query;
 }
 
+const std::string tileQuery( std::string query, float xmin, float ymin, float xmax, float ymax )
+{
+    std::stringstream bbox;
+    bbox << "ST_MakeEnvelope(" << xmin << "," << ymin << "," << xmax << "," << ymax << ")";
+    return replaceTile( query, bbox.str() );
+}
+
+const std::string preparedTileQuery( std::string query )
+{
+    return replaceTile( query, "ST_MakeEnvelope($1,$2,$3,$4)" );
+}
+
+const std::string densityQuery( const std::vector< std::string >& queries, const std::string& geocolumn,
+                                double xmin, double ymin, double xmax, double ymax, double tileSize )
+{
+    std::stringstream bbox;
+    bbox << std::setprecision( 16 ) << "ST_MakeEnvelope(" << xmin << "," << ymin << "," << xmax << "," << ymax << ")";
+
+    std::stringstream density;
+    density << std::setprecision( 16 ) << "SELECT ix::text, iy::text, max(n)::text FROM (";
+
+    for ( size_t ilod = 0; ilod < queries.size(); ilod++ ) {
+        density << ( ilod ? " UNION ALL " : "" )
+                << "SELECT floor((ST_X(c)-" << xmin << ")/" << tileSize << ")::int AS ix, "
+                << "floor((ST_Y(c)-" << ymin << ")/" << tileSize << ")::int AS iy, count(*) AS n "
+                << "FROM (SELECT ST_Centroid(" << geocolumn << ") AS c FROM (" << replaceTile( queries[ilod], bbox.str() ) << ") AS l) AS t "
+                << "GROUP BY 1, 2";
+    }
+
+    density << ") AS d GROUP BY ix, iy";
+    return density.str();
+}
+
 }
 }
@@ -26,6 +26,7 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
 #include <cassert>
 
 namespace Stack3d {
@@ -50,6 +51,8 @@ struct Interpreter: public OpenThreads::Thread {
                 << "    <unload name=\"layerName\">: unload layer.\n"
                 << "    <show name=\"layerName\">: show layer.\n"
                 << "    <hide name=\"layerName\">: hide layer.\n"
+                << "    <setPager threads=\"8\" http_threads=\"0\" max_pagedlod=\"2000\" target_frame_rate=\"60\">: configure tile loading.\n"
+                << "    <printStats>: averaged frame rate, cull and draw times of the last frames.\n"
                 ;
     }
     //bool list() const;
@@ -67,6 +70,8 @@ struct Interpreter: public OpenThreads::Thread {
     void addSky( const AttributeMap& );
     void lookAt( const AttributeMap& );
     void writeFile( const AttributeMap& );
+    void printStats( const AttributeMap& );
+    void setPager( const AttributeMap& );
 
 private:
 
@@ -79,6 +84,17 @@ private:
 
 const std::string tileQuery( std::string query, float xmin, float ymin, float xmax, float ymax );
 
+//! @return the query with tile bbox as parameters $1..$4 (xmin, ymin, xmax, ymax),
+//!         to be prepared once and executed for each tile
+const std::string preparedTileQuery( std::string query );
+
+//! @return the query of the number of features of each tile of the extent, rows of
+//!         (ix, iy, count) as text, for the level of detail with the most features
+//!         in the tile, features are counted in the tile of their centroid
+//! @param geocolumn the geometry column, or pos for bars
+const std::string densityQuery( const std::vector< std::string >& queries, const std::string& geocolumn,
+                                double xmin, double ymin, double xmax, double ymax, double tileSize );
+
 }
 }
 
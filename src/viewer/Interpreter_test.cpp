@@ -37,5 +37,25 @@ int main()
         assert(  squery == "SELECT * FROM table WHERE gid=2 AND ST_MakeEnvelope(-1,-2,3,4) && gom /*comment*/" );
     }
 
+    {
+        const std::string query( "SELECT * FROM table WHERE gid=2 /**AND TILE && gom*/ /*comment*/" );
+        std::cout << query << "\n";
+        const std::string squery( Stack3d::Viewer::preparedTileQuery( query ) );
+        std::cout << squery << "\n";
+        assert(  squery == "SELECT * FROM table WHERE gid=2 AND ST_MakeEnvelope($1,$2,$3,$4) && gom /*comment*/" );
+    }
+
+    {
+        std::vector< std::string > queries;
+        queries.push_back( "SELECT geom FROM roads /**WHERE TILE && geom*/" );
+        queries.push_back( "SELECT geom FROM buildings /**WHERE TILE && geom*/" );
+        const std::string squery( Stack3d::Viewer::densityQuery( queries, "geom", 1000, 2000, 1800, 2400, 200 ) );
+        std::cout << squery << "\n";
+        assert( squery.find( "SELECT geom FROM roads WHERE ST_MakeEnvelope(1000,2000,1800,2400) && geom" ) != std::string::npos );
+        assert( squery.find( "SELECT geom FROM buildings WHERE ST_MakeEnvelope(1000,2000,1800,2400) && geom" ) != std::string::npos );
+        assert( squery.find( "floor((ST_X(c)-1000)/200)" ) != std::string::npos );
+        assert( squery.find( " UNION ALL " ) != std::string::npos );
+    }
+
     return EXIT_SUCCESS;
 }
@@ -26,12 +26,17 @@
 #include <osgGA/OrbitManipulator>
 #include <osgGA/StateSetManipulator>
 #include <osgDB/ReadFile>
+#include <osgDB/DatabasePager>
+#include <osgUtil/IncrementalCompileOperation>
 #include <osgText/Text>
 #include <osg/io_utils>
 #include <osg/Texture2D>
+#include <osg/OperationThread>
 
 #include <cassert>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 800
 namespace Stack3d {
@@ -69,12 +74,18 @@ const char* fragSourceSSAO {
 
 ViewerWidget::ViewerWidget():
     osgViewer::Viewer()
+    , _pagerThreads( -1 )
+    , _pagerHttpThreads( -1 )
 {
     osg::setNotifyLevel( osg::NOTICE );
 
     //osg::DisplaySettings::instance()->setNumMultiSamples( 4 );
 
-    setThreadingModel( osgViewer::Viewer::SingleThreaded );
+    // draw of a frame overlaps update and cull of the next one, unless OSG_THREADING
+    // asks for another model, scene changes are made by update operations
+    if ( !getenv( "OSG_THREADING" ) ) {
+        setThreadingModel( osgViewer::Viewer::DrawThreadPerContext );
+    }
 
     osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
     {
@@ -129,6 +140,14 @@ ViewerWidget::ViewerWidget():
 
         setFrameStamp( new osg::FrameStamp );
 
+        // GL objects of loaded tiles are compiled before they are merged, within
+        // the frame time left, instead of at their first draw
+        setIncrementalCompileOperation( new osgUtil::IncrementalCompileOperation );
+
+        // always collected to be queried by frameStats(), not only when displayed
+        getViewerStats()->collectStats( "frame_rate", true );
+        camera->getStats()->collectStats( "rendering", true );
+
         setSceneData( _root.get() );
     }
 
@@ -236,12 +255,92 @@ osgGA::CameraManipulator* ViewerWidget::getCurrentManipulator()
     return manip;
 }
 
-void ViewerWidget::frame( double time )
+void ViewerWidget::updateTraversal()
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
-    osgViewer::Viewer::frame( time );
+    osgViewer::Viewer::updateTraversal();
 }
 
+//! add or remove a child of the root
+struct ChildOperation: osg::Operation {
+    ChildOperation( osg::Group* root, osg::Node* node, bool add )
+        : osg::Operation( "ChildOperation", false )
+        , _root( root )
+        , _node( node )
+        , _add( add )
+    {}
+
+    void operator()( osg::Object* ) {
+        if ( _add ) {
+            _root->addChild( _node.get() );
+        }
+        else {
+            _root->removeChild( _node.get() );
+        }
+    }
+
+private:
+    osg::ref_ptr<osg::Group> _root;
+    osg::ref_ptr<osg::Node> _node;
+    const bool _add;
+};
+
+struct NodeMaskOperation: osg::Operation {
+    NodeMaskOperation( osg::Node* node, osg::Node::NodeMask mask )
+        : osg::Operation( "NodeMaskOperation", false )
+        , _node( node )
+        , _mask( mask )
+    {}
+
+    void operator()( osg::Object* ) {
+        _node->setNodeMask( _mask );
+    }
+
+private:
+    osg::ref_ptr<osg::Node> _node;
+    const osg::Node::NodeMask _mask;
+};
+
+//! the stateset is replaced, not modified, the draw thread keeps a reference
+//! on the previous one until the end of the frame, so it can stay STATIC
+struct StateSetOperation: osg::Operation {
+    StateSetOperation( osg::Node* node, osg::StateSet* stateset )
+        : osg::Operation( "StateSetOperation", false )
+        , _node( node )
+        , _stateset( stateset )
+    {}
+
+    void operator()( osg::Object* ) {
+        _node->setStateSet( _stateset.get() );
+    }
+
+private:
+    osg::ref_ptr<osg::Node> _node;
+    osg::ref_ptr<osg::StateSet> _stateset;
+};
+
+//! the manipulator is used by the event and update traversals
+struct HomeOperation: osg::Operation {
+    HomeOperation( osgGA::CameraManipulator* manipulator, const osg::Vec3& eye, const osg::Vec3& center, const osg::Vec3& up )
+        : osg::Operation( "HomeOperation", false )
+        , _manipulator( manipulator )
+        , _eye( eye )
+        , _center( center )
+        , _up( up )
+    {}
+
+    void operator()( osg::Object* ) {
+        _manipulator->setHomePosition( _eye, _center, _up );
+        _manipulator->home( 0 );
+    }
+
+private:
+    osg::ref_ptr<osgGA::CameraManipulator> _manipulator;
+    const osg::Vec3 _eye;
+    const osg::Vec3 _center;
+    const osg::Vec3 _up;
+};
+
 void ViewerWidget::setDone( bool flag ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
@@ -251,7 +350,7 @@ void ViewerWidget::setDone( bool flag ) volatile {
 
 void ViewerWidget::setStateSet( const std::string& nodeId, osg::StateSet* stateset ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_nodeMapMutex );
 
     const NodeMap::const_iterator found = that->_nodeMap.find( nodeId );
 
@@ -259,25 +358,25 @@ void ViewerWidget::setStateSet( const std::string& nodeId, osg::StateSet* states
         throw std::runtime_error( "cannot find node '" + nodeId + "'" );
     }
 
-    found->second->setStateSet( stateset );
+    that->addUpdateOperation( new StateSetOperation( found->second.get(), stateset ) );
 }
 
 
 void ViewerWidget::addNode( const std::string& nodeId, osg::Node* node ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_nodeMapMutex );
 
     if ( that->_nodeMap.find( nodeId ) != that->_nodeMap.end() ) {
         throw std::runtime_error( "node '" + nodeId + "' already exists" );
     }
 
-    that->_root->addChild( node );
+    that->addUpdateOperation( new ChildOperation( that->_root.get(), node, true ) );
     that->_nodeMap.insert( std::make_pair( nodeId, node ) );
 }
 
 void ViewerWidget::removeNode(  const std::string& nodeId ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_nodeMapMutex );
 
     const NodeMap::const_iterator found = that->_nodeMap.find( nodeId );
 
@@ -285,12 +384,12 @@ void ViewerWidget::removeNode(  const std::string& nodeId ) volatile {
         throw std::runtime_error( "cannot find node '" + nodeId + "'" );
     }
 
-    that->_root->removeChild( found->second.get() );
+    that->addUpdateOperation( new ChildOperation( that->_root.get(), found->second.get(), false ) );
 }
 
 void ViewerWidget::setVisible( const std::string& nodeId, bool visible ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_nodeMapMutex );
 
     const NodeMap::const_iterator found = that->_nodeMap.find( nodeId );
 
@@ -298,14 +397,12 @@ void ViewerWidget::setVisible( const std::string& nodeId, bool visible ) volatil
         throw std::runtime_error( "cannot find node '" + nodeId + "'" );
     }
 
-    found->second->setNodeMask( visible ? 0xffffffff : 0x0 );
+    that->addUpdateOperation( new NodeMaskOperation( found->second.get(), visible ? 0xffffffff : 0x0 ) );
 }
 
 void ViewerWidget::setLookAt( const osg::Vec3& eye, const osg::Vec3& center, const osg::Vec3& up ) volatile {
     ViewerWidget* that = const_cast< ViewerWidget* >( this );
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
-    that->getCurrentManipulator()->setHomePosition( eye, center, up );
-    that->getCurrentManipulator()->home( 0 );
+    that->addUpdateOperation( new HomeOperation( that->getCurrentManipulator(), eye, center, up ) );
 }
 
 
@@ -326,8 +423,7 @@ void ViewerWidget::lookAtExtent( double xmin, double ymin, double xmax, double y
     const osg::Vec3 center( xmin+.5*( xmax-xmin ), ymin+.5*( ymax-ymin ), 0 );
     const osg::Vec3 eye( center.x(), center.y(), altitude );
 
-    that->getCurrentManipulator()->setHomePosition( eye, center, up );
-    that->getCurrentManipulator()->home( 0 );
+    that->addUpdateOperation( new HomeOperation( that->getCurrentManipulator(), eye, center, up ) );
 }
 
 void ViewerWidget::writeFile( const std::string& filename ) volatile {
@@ -339,6 +435,96 @@ void ViewerWidget::writeFile( const std::string& filename ) volatile {
     }
 }
 
+//! the pager is used by the cull and update traversals
+struct PagerOperation: osg::Operation {
+    PagerOperation( osgDB::DatabasePager* pager, int threads, int httpThreads, int maxPagedLod )
+        : osg::Operation( "PagerOperation", false )
+        , _pager( pager )
+        , _threads( threads )
+        , _httpThreads( httpThreads )
+        , _maxPagedLod( maxPagedLod )
+    {}
+
+    void operator()( osg::Object* ) {
+        if ( _threads > 0 ) {
+            // pending requests are kept, the new threads start with the next request,
+            // cancel() joins the running threads: the frame waits for their current load
+            _pager->cancel();
+            _pager->setUpThreads( _threads, _httpThreads );
+        }
+
+        if ( _maxPagedLod >= 0 ) {
+            _pager->setTargetMaximumNumberOfPageLOD( _maxPagedLod );
+        }
+    }
+
+private:
+    osg::ref_ptr<osgDB::DatabasePager> _pager;
+    const int _threads;
+    const int _httpThreads;
+    const int _maxPagedLod;
+};
+
+void ViewerWidget::setPager( int threads, int httpThreads, int maxPagedLod, double targetFrameRate ) volatile {
+    ViewerWidget* that = const_cast< ViewerWidget* >( this );
+
+    if ( threads >= 0 || httpThreads >= 0 ) {
+        if ( threads < 0 ) {
+            threads = that->getDatabasePager()->getNumDatabaseThreads();
+        }
+
+        if ( httpThreads < 0 ) {
+            httpThreads = 0;
+        }
+
+        if ( threads < 1 || httpThreads >= threads ) {
+            throw std::runtime_error( "at least one loading thread is needed besides http threads" );
+        }
+
+        // threads are only restarted when their numbers change
+        if ( threads == that->_pagerThreads && httpThreads == that->_pagerHttpThreads ) {
+            threads = httpThreads = -1;
+        }
+        else {
+            that->_pagerThreads = threads;
+            that->_pagerHttpThreads = httpThreads;
+        }
+    }
+
+    that->addUpdateOperation( new PagerOperation( that->getDatabasePager(), threads, httpThreads, maxPagedLod ) );
+
+    if ( targetFrameRate > 0 ) {
+        that->getIncrementalCompileOperation()->setTargetFrameRate( targetFrameRate );
+    }
+}
+
+void ViewerWidget::frameStats( double& frameRate, double& cull, double& draw ) volatile {
+    ViewerWidget* that = const_cast< ViewerWidget* >( this );
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( that->_mutex );
+
+    osg::Stats* viewerStats = that->getViewerStats();
+    osg::Stats* cameraStats = that->getCamera()->getStats();
+
+    frameRate = cull = draw = 0;
+
+    // no complete frame yet, last would wrap around
+    if ( viewerStats->getLatestFrameNumber() == 0 ) {
+        return;
+    }
+
+    // the latest frame may not be complete
+    const unsigned last = viewerStats->getLatestFrameNumber() - 1;
+    const unsigned first = std::max( viewerStats->getEarliestFrameNumber(), cameraStats->getEarliestFrameNumber() );
+
+    if ( first > last ) {
+        return;
+    }
+
+    viewerStats->getAveragedAttribute( first, last, "Frame rate", frameRate, true );
+    cameraStats->getAveragedAttribute( first, last, "Cull traversal time taken", cull );
+    cameraStats->getAveragedAttribute( first, last, "Draw traversal time taken", draw );
+}
+
 }
 }
 
@@ -39,6 +39,16 @@ struct ViewerWidget: osgViewer::Viewer {
     void lookAtExtent( double xmin, double ymin, double xmax, double ymax ) volatile;
     void writeFile( const std::string& filename ) volatile;
 
+    //! configure the database pager, negative values are left unchanged
+    //! @param threads total number of loading threads, including httpThreads, that are
+    //!        none if unspecified
+    //! @param maxPagedLod number of PagedLODs above which unused children are expired
+    //! @param targetFrameRate GL objects of loaded tiles are compiled within the frame time left
+    void setPager( int threads, int httpThreads, int maxPagedLod, double targetFrameRate ) volatile;
+
+    //! averaged over the frames in stats history, times in seconds
+    void frameStats( double& frameRate, double& cull, double& draw ) volatile;
+
 private:
 
     osgGA::CameraManipulator* getCurrentManipulator();
@@ -46,7 +56,16 @@ private:
     osg::ref_ptr<osg::Group> _root;
     typedef std::map< std::string, osg::ref_ptr<osg::Node> > NodeMap;
     NodeMap _nodeMap;
-    void frame( double time );
+    OpenThreads::Mutex _nodeMapMutex;
+
+    //! last pager threads configuration, -1 until setPager() sets it, used and
+    //! changed by the interpreter thread only
+    int _pagerThreads;
+    int _pagerHttpThreads;
+
+    //! scene changes are queued as update operations by the interpreter thread,
+    //! _mutex is held during the update traversal only
+    void updateTraversal();
 };
 
 }